@@ -0,0 +1,9 @@
+@ECHO OFF
+REM run from AUTOEXEC.BAT by script/bench
+ECHO BENCH START > COM1
+C:\DOSLINUX\DSL true
+C:\BENCH\DSLLAT
+C:\BENCH\DISKBNCH
+C:\BENCH\KEYLAT
+C:\DOSLINUX\DSL sh /mnt/c/bench/vfat.sh start
+C:\DOSLINUX\DSL sh /mnt/c/bench/vfat.sh done
@@ -0,0 +1,164 @@
+; measures sequential disk throughput from DOS, through BIOS INT 13h track
+; reads from the first hard disk and through DOS INT 21h file writes and
+; reads of a scratch file
+cpu 386
+org 0x100
+
+%define CHUNK 32768
+%define CHUNKS 128
+
+main:
+    ; INT 13h: read whole tracks from the start of the disk
+    mov ah, 0x08
+    mov dl, 0x80
+    int 0x13
+    jc int21
+
+    and cl, 0x3f
+    mov [sectors], cl
+    inc dh
+    mov [heads], dh
+
+    call read_ticks
+    mov [start_ticks], eax
+
+.track:
+    ; cylinder = track / heads, head = track % heads
+    mov ax, [track]
+    xor dx, dx
+    movzx bx, byte [heads]
+    div bx
+
+    ; CH holds the low 8 bits of the cylinder, CL bits 8-9 and the sector
+    mov ch, al
+    mov cl, ah
+    shl cl, 6
+    or cl, 1
+    mov dh, dl
+    mov dl, 0x80
+    mov al, [sectors]
+    mov ah, 0x02
+    mov bx, buffer
+    int 0x13
+    jc .read_done
+
+    movzx eax, byte [sectors]
+    shl eax, 9
+    add [bytes], eax
+    inc word [track]
+    cmp dword [bytes], CHUNK * CHUNKS
+    jb .track
+
+.read_done:
+    mov si, int13_read_name
+    call report_throughput
+
+int21:
+    ; INT 21h: write a scratch file in CHUNK sized writes
+    mov ah, 0x3c
+    xor cx, cx
+    mov dx, scratch_path
+    int 0x21
+    jc fail
+    mov [handle], ax
+
+    call read_ticks
+    mov [start_ticks], eax
+    mov word [count], CHUNKS
+
+.write:
+    mov ah, 0x40
+    mov bx, [handle]
+    mov cx, CHUNK
+    mov dx, buffer
+    int 0x21
+    jc fail
+    dec word [count]
+    jnz .write
+
+    ; closing and a disk reset make sure it has all reached the disk
+    mov ah, 0x3e
+    mov bx, [handle]
+    int 0x21
+    mov ah, 0x0d
+    int 0x21
+
+    mov dword [bytes], CHUNK * CHUNKS
+    mov si, int21_write_name
+    call report_throughput
+
+    ; and read it back
+    mov ax, 0x3d00
+    mov dx, scratch_path
+    int 0x21
+    jc fail
+    mov [handle], ax
+
+    call read_ticks
+    mov [start_ticks], eax
+    mov word [count], CHUNKS
+
+.read:
+    mov ah, 0x3f
+    mov bx, [handle]
+    mov cx, CHUNK
+    mov dx, buffer
+    int 0x21
+    jc fail
+    dec word [count]
+    jnz .read
+
+    mov ah, 0x3e
+    mov bx, [handle]
+    int 0x21
+
+    mov si, int21_read_name
+    call report_throughput
+
+    mov ah, 0x41
+    mov dx, scratch_path
+    int 0x21
+
+    mov ax, 0x4c00
+    int 0x21
+
+fail:
+    ; report the DOS error code
+    movzx eax, ax
+    push eax
+    mov si, error_name
+    call begin_report
+    pop eax
+    call report_value
+    call end_report
+
+    mov ax, 0x4c01
+    int 0x21
+
+; reports the result named at SI as ticks since start_ticks and bytes
+report_throughput:
+    call begin_report
+    call read_ticks
+    sub eax, [start_ticks]
+    call report_value
+    mov eax, [bytes]
+    call report_value
+    jmp end_report
+
+int13_read_name db "int13_read", 0
+int21_write_name db "int21_write", 0
+int21_read_name db "int21_read", 0
+error_name db "diskbench_error", 0
+scratch_path db "C:\BENCH\BENCH.DAT", 0
+
+start_ticks dd 0
+bytes dd 0
+track dw 0
+count dw 0
+handle dw 0
+sectors db 0
+heads db 0
+
+%include "lib.inc"
+
+buffer:
@@ -0,0 +1,45 @@
+; times round trips through the DSL run command syscall with a command that
+; does nothing. run straight after DSL has started, so it also marks the end
+; of boot for script/bench
+cpu 386
+org 0x100
+
+%define ITERATIONS 50
+
+main:
+    mov si, booted_name
+    call begin_report
+    call end_report
+
+    call read_ticks
+    mov [start_ticks], eax
+    mov word [count], ITERATIONS
+
+.loop:
+    mov si, true_cmd
+    call run_linux
+    dec word [count]
+    jnz .loop
+
+    call read_ticks
+    sub eax, [start_ticks]
+    push eax
+
+    mov si, dsl_true_name
+    call begin_report
+    pop eax
+    call report_value
+    mov eax, ITERATIONS
+    call report_value
+    call end_report
+
+    mov ax, 0x4c00
+    int 0x21
+
+booted_name db "booted", 0
+dsl_true_name db "dsl_true", 0
+true_cmd db "true", 0
+start_ticks dd 0
+count dw 0
+
+%include "lib.inc"
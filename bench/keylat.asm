@@ -0,0 +1,48 @@
+; reads KEYS keystrokes through INT 16h as fast as script/bench can inject
+; them with dslkeys, timing from the first key to the last
+cpu 386
+org 0x100
+
+; must match KEYS in script/bench
+%define KEYS 200
+
+main:
+    mov si, ready_name
+    call begin_report
+    call end_report
+
+    ; the first key starts the clock
+    xor ah, ah
+    int 0x16
+
+    call read_ticks
+    mov [start_ticks], eax
+    mov word [count], KEYS - 1
+
+.loop:
+    xor ah, ah
+    int 0x16
+    dec word [count]
+    jnz .loop
+
+    call read_ticks
+    sub eax, [start_ticks]
+    push eax
+
+    mov si, keys_name
+    call begin_report
+    pop eax
+    call report_value
+    mov eax, KEYS - 1
+    call report_value
+    call end_report
+
+    mov ax, 0x4c00
+    int 0x21
+
+ready_name db "keylat_ready", 0
+keys_name db "keys", 0
+start_ticks dd 0
+count dw 0
+
+%include "lib.inc"
@@ -0,0 +1,20 @@
+# run by bench.bat through dsl. "start" reports the start time then writes to
+# the DOS drive from linux, "done" reports once that dsl has returned, so the
+# time between them includes flushing the writes back for DOS
+
+DIR=/mnt/c/bench/vfat.tmp
+
+case "$1" in
+    start)
+        echo "RESULT vfat_start" > /dev/ttyS0
+        mkdir -p $DIR
+        dd if=/dev/zero of=$DIR/big bs=4k count=1024 2>/dev/null
+        for i in $(seq 256); do
+            echo "$i" > $DIR/$i
+        done
+        ;;
+    done)
+        echo "RESULT vfat_write $((4096 * 1024)) 256" > /dev/ttyS0
+        rm -rf $DIR
+        ;;
+esac
@@ -0,0 +1,74 @@
+/* client side of the DSL message ring, for 16 bit DOS C compilers (Turbo C,
+ * Open Watcom). see init/ring.h for the protocol */
+
+#ifndef DSLRING_H
+#define DSLRING_H
+
+#include <dos.h>
+#include <string.h>
+
+#define DSLRING_SEG 0xffff
+#define DSLRING_OFF 0xd010
+#define DSLRING_MAGIC 0x474e5244UL
+#define DSLRING_SIZE 0x2000
+#define DSLRING_MAX_PAYLOAD (DSLRING_SIZE / 2 - 4)
+
+typedef struct dslring_header {
+    unsigned long magic;
+    unsigned short size;
+    volatile unsigned short head;
+    volatile unsigned short tail;
+    unsigned short dropped;
+    unsigned long reserved;
+} dslring_header_t;
+
+/* sends a message of type 1 or above. returns 0 on success, or -1 if DSL is
+ * not running or the ring is full, in which case try again later */
+static int
+dslring_send(unsigned short type, const void* payload, unsigned short len)
+{
+    dslring_header_t far* header = MK_FP(DSLRING_SEG, DSLRING_OFF);
+    unsigned char far* data = (unsigned char far*)(header + 1);
+    unsigned short head, avail, off, rec, pad = 0;
+    union REGS regs;
+
+    if (header->magic != DSLRING_MAGIC || len > DSLRING_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    head = header->head;
+    avail = DSLRING_SIZE - (unsigned short)(head - header->tail);
+    off = head & (DSLRING_SIZE - 1);
+    rec = (4 + len + 3) & ~3;
+
+    if (rec > DSLRING_SIZE - off) {
+        /* does not fit before the end, pad it out and start again at 0 */
+        pad = DSLRING_SIZE - off;
+    }
+
+    if (pad + rec > avail) {
+        return -1;
+    }
+
+    if (pad) {
+        *(unsigned short far*)(data + off) = pad - 4;
+        *(unsigned short far*)(data + off + 2) = 0;
+        off = 0;
+    }
+
+    *(unsigned short far*)(data + off) = len;
+    *(unsigned short far*)(data + off + 2) = type;
+    _fmemcpy(data + off + 4, payload, len);
+
+    header->head = head + pad + rec;
+
+    /* if the ring was empty the VMM may not look at it for a while */
+    if (avail == DSLRING_SIZE) {
+        regs.h.ah = 0x08;
+        int86(0xe7, &regs, &regs);
+    }
+
+    return 0;
+}
+
+#endif
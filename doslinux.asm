@@ -42,20 +42,243 @@ run_command:
     mov ah, 0x0d
     int 0x21
 
+    ; -b, -j or -w in front of the command
+    call parse_option
+    mov al, [option]
+    cmp al, 'j'
+    je list_jobs
+    cmp al, 'w'
+    je wait_job
+    cmp al, 'b'
+    je background_command
+
+    ; stream stdin and stdout through the VMM if DOS has them redirected to
+    ; files or pipes, rather than the console
+    mov ax, 0x4400
+    xor bx, bx
+    int 0x21
+    jc .stdout
+    test dl, 0x80
+    jnz .stdout
+    or byte [bridge_flags], 1
+
+.stdout:
+    mov ax, 0x4400
+    mov bx, 1
+    int 0x21
+    jc .check_bridge
+    test dl, 0x80
+    jnz .check_bridge
+    or byte [bridge_flags], 2
+
+.check_bridge:
+    cmp byte [bridge_flags], 0
+    jne bridge_command
+
     ; invoke the run command syscall
     mov ah, 1
     mov dl, [current_drive]
     mov si, current_dir_buffer
     int DOSLINUX_INT
 
+    ; and again, so DOS drops any buffers of disk sectors the command changed
+    mov ah, 0x0d
+    int 0x21
+
     ; replicate linux cursor position in BIOS
     call fix_cursor
 
     ; exit
+    mov ax, 0x4c00
+    int 0x21
+
+bridge_command:
+    ; start the command, then do whatever DOS side I/O it asks for until it
+    ; exits. data goes through the buffer in the reserved area above 1M
+    mov ah, 6
+    mov bl, [bridge_flags]
+    mov dl, [current_drive]
+    mov si, current_dir_buffer
+    int DOSLINUX_INT
+
+.request:
+    cmp ax, BRIDGE_WRITE
+    je .write
+    cmp ax, BRIDGE_READ
+    je .read
+
+    ; done, exit with the command's status
+    push cx
+    mov ah, 0x0d
+    int 0x21
+    call fix_cursor
+    pop ax
+    mov ah, 0x4c
+    int 0x21
+
+.write:
+    mov bx, 1
+    mov ah, 0x40
+    jmp .io
+
+.read:
+    xor bx, bx
+    mov ah, 0x3f
+
+.io:
+    push ds
+    mov dx, BRIDGE_SEG
+    mov ds, dx
+    mov dx, BRIDGE_OFF
+    int 0x21
+    pop ds
+    jnc .result
+    xor ax, ax
+
+.result:
+    ; bytes transferred go back in CX
+    mov cx, ax
+    mov ah, 7
+    int DOSLINUX_INT
+    jmp .request
+
+background_command:
+    ; start the command as a job and say which
+    mov ah, 2
+    mov dl, [current_drive]
+    mov si, current_dir_buffer
+    int DOSLINUX_INT
+
+    mov dx, job_start_err
+    test ax, ax
+    jz fatal_plain
+
+    call print_job_id
+    mov dx, job_started
+    mov ah, 0x09
+    int 0x21
+
+    mov ax, 0x4c00
+    int 0x21
+
+list_jobs:
+    mov ah, 5
+    mov cx, JOB_LIST_MAX
+    mov di, job_list
+    push cs
+    pop es
+    int DOSLINUX_INT
+
+    mov cx, ax
+    mov si, job_list
+
+.next:
+    jcxz .done
+    push cx
+
+    mov ax, [si]
+    call print_job_id
+
+    cmp word [si + 2], 0
+    jne .exited
+
+    mov dx, job_running
+    mov ah, 0x09
+    int 0x21
+    jmp .printed
+
+.exited:
+    mov dx, job_exited
+    mov ah, 0x09
+    int 0x21
+    mov ax, [si + 4]
+    call print_dec
+    mov dx, newline
+    mov ah, 0x09
+    int 0x21
+
+.printed:
+    add si, 6
+    pop cx
+    dec cx
+    jmp .next
+
+.done:
+    mov ax, 0x4c00
+    int 0x21
+
+wait_job:
+    ; optional job id, otherwise whichever finishes first
+    call parse_number
+
+    mov ah, 4
+    int DOSLINUX_INT
+
+    ; DOS may have buffered sectors the job changed
+    push ax
+    push bx
+    push cx
+    mov ah, 0x0d
+    int 0x21
+    pop cx
+    pop bx
+    pop ax
+
+    mov dx, no_job_err
+    cmp ax, 0xffff
+    je fatal_plain
+
+    ; report it, exiting with its status so batch files can check ERRORLEVEL
+    push cx
+    mov ax, bx
+    call print_job_id
+    mov dx, job_exited
+    mov ah, 0x09
+    int 0x21
+    pop ax
+    push ax
+    call print_dec
+    mov dx, newline
+    mov ah, 0x09
+    int 0x21
+
+    pop ax
     mov ah, 0x4c
     int 0x21
 
 start_linux:
+    ; progress dots follow this as the kernel loads
+    mov dx, initializing
+    mov ah, 0x09
+    int 0x21
+
+    ; the read buffer goes in the memory after our 64k segment, up to the
+    ; end of the block DOS gave us (from the PSP) or READBUF_MAX
+    mov ax, cs
+    add ax, 0x1000
+    mov [readbuf_seg], ax
+    mov bx, [0x02]
+    sub bx, ax
+    mov dx, no_memory_err
+    jbe fatal
+
+    movzx eax, bx
+    shl eax, 4
+    cmp eax, READBUF_MAX
+    jbe .readbuf_fits
+    mov eax, READBUF_MAX
+.readbuf_fits:
+
+    ; whole chunks only
+    xor edx, edx
+    mov ecx, READ_CHUNK
+    div ecx
+    mov dx, no_memory_err
+    test eax, eax
+    jz fatal
+    mul ecx
+    mov [readbuf_size], eax
+
     ; open bzimage.com
     mov ax, 0x3d00
     mov dx, bzimage_path
@@ -106,37 +329,29 @@ start_linux:
     shl eax, 4 ; multiply by 16 to get bytes
     mov [sys_bytes], eax
 
-    ; calculate sys_load_end pointer
-    add eax, [sys_load_ptr]
-    mov [sys_load_end], eax
-
     ; init unreal mode switching in prep for loading kernel to extended memory
     call init_unreal
 
-.sys_load_loop:
-    mov ah, 0x3f
-    mov dx, readbuf
+    ; read the rest of the kernel in
     mov bx, [bzimage_handle]
-    mov cx, READBUF_SIZE
-    int 0x21
+    mov edi, kernel_base
+    mov edx, [sys_bytes]
+    call read_high
 
     ; check error
     mov dx, bzimage_read_err
     jc fatal
 
-    ; do unreal copy
-    mov si, readbuf
-    mov edi, [sys_load_ptr]
-    mov ecx, READBUF_SIZE
-    call copy_unreal
-
-    ; advance load pointer
-    add dword [sys_load_ptr], READBUF_SIZE
+    ; close bzimage
+    mov ah, 0x3e
+    mov bx, [bzimage_handle]
+    int 0x21
 
-    ; loop around again if more to read
-    mov eax, [sys_load_ptr]
-    cmp eax, [sys_load_end]
-    jb .sys_load_loop
+    ; load the prebuilt root filesystem if there is one, otherwise the kernel
+    ; mounts the DOS drive as root and init builds one at runtime
+    mov dword [k_ramdisk_size_d], 0
+    mov dword [k_ramdisk_image_d], 0
+    call load_initrd
 
     ; finished reading kernel, set obligatory kernel params:
 
@@ -151,19 +366,73 @@ start_linux:
     %define CAN_USE_HEAP_FLAG 0x80
     mov byte [k_loadflags_b], LOADED_HIGH_FLAG | CAN_USE_HEAP_FLAG
 
-    ; no ramdisk
-    mov dword [k_ramdisk_size_d], 0
-    mov dword [k_ramdisk_image_d], 0
-
     ; set heap end pointer - TODO is this correct?
     %define HEAP_END 0xe000
     mov word [k_heap_end_ptr_w], HEAP_END
 
-    ; copy cmd line into place
+    ; copy cmd line into place, leaving off the terminating NUL
     mov si, cmdline
     mov di, bzimage + HEAP_END
-    mov cx, cmdline.end - cmdline
+    mov cx, cmdline.end - cmdline - 1
     rep movsb
+
+    ; append the dsl_* options dsl was started with from the PSP command
+    ; tail, for init. other words there, like a command, stay off the kernel
+    ; command line. BX is the end of the tail
+    movzx bx, byte [0x80]
+    add bx, 0x81
+    mov si, 0x81
+
+.next_word:
+    cmp si, bx
+    jae .words_done
+    mov al, [si]
+    cmp al, ' '
+    je .skip_blank
+    cmp al, 9
+    jne .check_word
+
+.skip_blank:
+    inc si
+    jmp .next_word
+
+.check_word:
+    mov cx, bx
+    sub cx, si
+    cmp cx, 4
+    jb .skip_word
+    cmp dword [si], 'dsl_'
+    jne .skip_word
+
+.copy_word:
+    movsb
+    cmp si, bx
+    jae .word_copied
+    mov al, [si]
+    cmp al, ' '
+    je .word_copied
+    cmp al, 9
+    jne .copy_word
+
+.word_copied:
+    mov byte [di], ' '
+    inc di
+    jmp .next_word
+
+.skip_word:
+    inc si
+    cmp si, bx
+    jae .words_done
+    mov al, [si]
+    cmp al, ' '
+    je .next_word
+    cmp al, 9
+    jne .skip_word
+    jmp .next_word
+
+.words_done:
+    mov byte [di], 0
+
     ; now calculate linear address for pointer
     mov ax, ds
     movzx eax, ax
@@ -175,7 +444,37 @@ start_linux:
     ; set kernel boot params relevant to relocation
     mov dword [k_code32_start_d], kernel_base
 
-    ; write CS:IP of vm86_return into somewhere init can grab it from
+    ; find the first memory control block from the DOS List of Lists, init
+    ; walks the chain from there to tell which program owns what memory
+    push es
+    mov ah, 0x52
+    int 0x21
+    mov dx, [es:bx - 2]
+    mov [lol_ptr], bx
+    mov [lol_ptr + 2], es
+    pop es
+
+    ; and the swappable data area, where DOS leaves the arguments of the
+    ; file calls it passes on to the redirector drive
+    push dx
+    push ds
+    mov ax, 0x5d06
+    int 0x21
+    mov ax, ds
+    pop ds
+    pop dx
+    mov [sda_ptr], si
+    mov [sda_ptr + 2], ax
+
+    ; both of those are laid out differently before DOS 4, init needs the
+    ; version to tell. major in the high byte
+    mov ah, 0x30
+    int 0x21
+    xchg al, ah
+    mov [dos_version], ax
+
+    ; write CS:IP of vm86_return into somewhere init can grab it from, along
+    ; with the rest of the state it needs
     call enter_unreal
     push es
     mov ax, 0x08
@@ -195,14 +494,20 @@ start_linux:
     mov ax, ss
     a32 mov [es:0x100008], word ax
 
+    a32 mov [es:0x10000a], dx
+
+    mov eax, [lol_ptr]
+    a32 mov [es:0x10000c], eax
+
+    mov eax, [sda_ptr]
+    a32 mov [es:0x100010], eax
+
+    mov ax, [dos_version]
+    a32 mov [es:0x100014], ax
+
     call exit_unreal
     pop es
 
-    ; print initializing message right before starting kernel
-    mov dx, initializing
-    mov ah, 0x09
-    int 0x21
-
     ; calculate kernel segment
     mov ax, ds
     movzx eax, ax
@@ -242,11 +547,138 @@ vm86_return:
 
 ; print error message and exit
 fatal:
+    ; we are partway through the starting message
+    push dx
+    mov dx, newline
+    mov ah, 0x09
+    int 0x21
+    pop dx
+
     mov ah, 0x09
     int 0x21
     mov ah, 0x4c
     int 0x21
 
+; print error message and exit, when not in the middle of a line
+fatal_plain:
+    mov ah, 0x09
+    int 0x21
+    mov ax, 0x4cff
+    int 0x21
+
+; looks for -b, -j or -w at the start of the PSP command tail and strips it so
+; what is left is the command. sets option to the letter, or 0
+parse_option:
+    mov byte [option], 0
+    push cs
+    pop es
+
+    mov si, 0x81
+    movzx cx, byte [0x80]
+
+.skip_space:
+    jcxz .done
+    cmp byte [si], ' '
+    jne .dash
+    inc si
+    dec cx
+    jmp .skip_space
+
+.dash:
+    cmp cx, 2
+    jb .done
+    cmp byte [si], '-'
+    jne .done
+
+    ; must be a word on its own
+    cmp cx, 2
+    je .letter
+    cmp byte [si + 2], ' '
+    jne .done
+
+.letter:
+    mov al, [si + 1]
+    or al, 0x20
+    cmp al, 'b'
+    je .found
+    cmp al, 'j'
+    je .found
+    cmp al, 'w'
+    jne .done
+
+.found:
+    mov [option], al
+
+    ; move the rest of the tail down over it
+    add si, 2
+    sub cx, 2
+    mov [0x80], cl
+    mov di, 0x81
+    rep movsb
+    mov byte [di], 13
+
+.done:
+    ret
+
+; parses a decimal number from the PSP command tail into BX, 0 if none
+parse_number:
+    xor bx, bx
+    mov si, 0x81
+    movzx cx, byte [0x80]
+
+.next:
+    jcxz .done
+    lodsb
+    dec cx
+    cmp al, ' '
+    je .next
+    sub al, '0'
+    cmp al, 9
+    ja .done
+    movzx ax, al
+    imul bx, bx, 10
+    add bx, ax
+    jmp .next
+
+.done:
+    ret
+
+; prints "[AX]"
+print_job_id:
+    push ax
+    mov dl, '['
+    mov ah, 0x02
+    int 0x21
+    pop ax
+    call print_dec
+    mov dl, ']'
+    mov ah, 0x02
+    int 0x21
+    ret
+
+; prints AX in decimal
+; clobbers AX, BX, CX, DX
+print_dec:
+    mov bx, 10
+    xor cx, cx
+
+.divide:
+    xor dx, dx
+    div bx
+    push dx
+    inc cx
+    test ax, ax
+    jnz .divide
+
+.print:
+    pop dx
+    add dl, '0'
+    mov ah, 0x02
+    int 0x21
+    loop .print
+
+    ret
+
 ; initialize unreal mode switching
 init_unreal:
     ; setup gdt offset in gdtr
@@ -257,20 +689,21 @@ init_unreal:
 
     ret
 
-; copy from low to extended memory (> 1 MiB)
-; DS:ESI - source (far pointer)
+; copy between any two places in memory, in one trip to protected mode
+; ESI - source (linear address)
 ; EDI - destination (linear address)
 ; ECX - byte count
-; clobbers EAX
+; clobbers EAX, ECX, ESI, EDI
 copy_unreal:
-    ; zero high bits of ESI
-    movzx eax, si
-    mov esi, eax
+    ; enter_unreal disables interrupts, restore them afterwards
+    pushf
 
     ; save ds/es and load 32 bit segment selectors
     call enter_unreal
+    push ds
     push es
     mov ax, 0x08
+    mov ds, ax
     mov es, ax
 
     ; copy 4 bytes at a time:
@@ -283,7 +716,142 @@ copy_unreal:
     ; restore ds/es
     call exit_unreal
     pop es
+    pop ds
+
+    popf
+    ret
+
+; read a file into extended memory. fills as much of the buffer above our
+; segment as it can with READ_CHUNK sized reads, then copies the lot up in one
+; unreal mode switch, printing a dot per batch
+; BX - file handle
+; EDI - destination (linear address)
+; EDX - byte count
+; returns CF set on error
+; clobbers EAX, ECX, EDX, ESI, EDI
+read_high:
+    mov [read_high_ptr], edi
+    add edx, edi
+    mov [read_high_end], edx
+
+.batch:
+    mov dword [read_high_len], 0
+
+.chunk:
+    ; stop reading once the batch has the rest of the file or is full
+    mov eax, [read_high_end]
+    sub eax, [read_high_ptr]
+    cmp eax, [read_high_len]
+    jbe .copy
+
+    mov eax, [read_high_len]
+    cmp eax, [readbuf_size]
+    jae .copy
+
+    ; chunks are contiguous, read the next one in at readbuf_seg + len
+    shr eax, 4
+    add ax, [readbuf_seg]
+    push ds
+    mov ds, ax
+    xor dx, dx
+    mov cx, READ_CHUNK
+    mov ah, 0x3f
+    int 0x21
+    pop ds
+    jc .done
+
+    movzx eax, ax
+    add [read_high_len], eax
+
+    ; a short read is the end of the file
+    cmp eax, READ_CHUNK
+    je .chunk
+
+.copy:
+    ; nothing left in the file before we got everything
+    mov ecx, [read_high_len]
+    test ecx, ecx
+    stc
+    jz .done
+
+    movzx esi, word [readbuf_seg]
+    shl esi, 4
+    mov edi, [read_high_ptr]
+    call copy_unreal
+
+    mov eax, [read_high_len]
+    add [read_high_ptr], eax
+
+    mov ah, 0x02
+    mov dl, '.'
+    int 0x21
+
+    ; loop around again if more to read
+    mov eax, [read_high_ptr]
+    cmp eax, [read_high_end]
+    jb .batch
 
+    clc
+.done:
+    ret
+
+; load initrd.gz into extended memory and point the kernel header at it,
+; leaves the header alone if there is no initrd.gz
+load_initrd:
+    mov ax, 0x3d00
+    mov dx, initrd_path
+    int 0x21
+    jc .done
+    mov [initrd_handle], ax
+
+    ; seek to the end for the size, which comes back in DX:AX
+    mov ax, 0x4202
+    mov bx, [initrd_handle]
+    xor cx, cx
+    xor dx, dx
+    int 0x21
+    mov dx, initrd_read_err
+    jc fatal
+
+    push dx
+    push ax
+    pop eax
+    mov [initrd_bytes], eax
+
+    ; and back to the start
+    mov ax, 0x4200
+    mov bx, [initrd_handle]
+    xor cx, cx
+    xor dx, dx
+    int 0x21
+    mov dx, initrd_read_err
+    jc fatal
+
+    ; the kernel isn't relocatable, it decompresses itself to its preferred
+    ; address and needs init_size bytes from there. put the initrd after that
+    mov edi, [k_pref_address_q]
+    cmp edi, kernel_base
+    jae .above_kernel
+    mov edi, kernel_base
+.above_kernel:
+    add edi, [k_init_size_d]
+    add edi, 0xfff
+    and edi, ~0xfff
+
+    mov [k_ramdisk_image_d], edi
+    mov edx, [initrd_bytes]
+    mov [k_ramdisk_size_d], edx
+
+    mov bx, [initrd_handle]
+    call read_high
+    mov dx, initrd_read_err
+    jc fatal
+
+    mov ah, 0x3e
+    mov bx, [initrd_handle]
+    int 0x21
+
+.done:
     ret
 
 enter_unreal:
@@ -410,7 +978,15 @@ xms_not_supported db "Extended memory manager detected (maybe HIMEM.SYS?) - cann
 bzimage_path db "C:\doslinux\bzimage", 0
 bzimage_open_err db "Could not open bzImage", 13, 10, "$"
 bzimage_read_err db "Could not read bzImage", 13, 10, "$"
+initrd_path db "C:\doslinux\initrd.gz", 0
+initrd_read_err db "Could not read initrd.gz", 13, 10, "$"
 not_kernel_err db "bzImage is not a Linux kernel", 13, 10, "$"
+no_memory_err db "Not enough conventional memory to load Linux", 13, 10, "$"
+job_start_err db "Could not start background job", 13, 10, "$"
+no_job_err db "No such job", 13, 10, "$"
+job_started db " started in /run/dsl/jobs, keep it off C: while DOS runs", 13, 10, "$"
+job_running db " running", 13, 10, "$"
+job_exited db " exited $"
 initializing db "Starting DOS Subsystem for Linux, please wait...$"
 newline db 13, 10, "$"
 
@@ -461,12 +1037,22 @@ align 4
 bzimage_handle: dw 0
 setup_bytes: dw 0
 heap_end: dw 0
+dos_version: dw 0
 
 align 4
 sys_bytes: dd 0
-sys_load_ptr: dd kernel_base
-sys_load_end: dd 0
-
+initrd_bytes: dd 0
+lol_ptr: dd 0
+sda_ptr: dd 0
+read_high_ptr: dd 0
+read_high_end: dd 0
+read_high_len: dd 0
+readbuf_size: dd 0
+readbuf_seg: dw 0
+initrd_handle: dw 0
+
+option: db 0
+bridge_flags: db 0
 current_drive: db 0
 current_dir_buffer: times 64 db 0
 
@@ -482,6 +1068,16 @@ gdtr:
 
 kernel_base equ 0x200000
 
+; stdio bridge, must match init/bridge.h
+BRIDGE_SEG equ 0xffff
+BRIDGE_OFF equ 0x1010
+BRIDGE_WRITE equ 1
+BRIDGE_READ equ 2
+
+; jobs dsl -j lists, the VMM's JOB_MAX. 6 byte entries of id, state and
+; exit status
+JOB_LIST_MAX equ 16
+
 ; kernel real mode header fields
 ; see https://www.kernel.org/doc/html/latest/x86/boot.html#the-real-mode-kernel-header
 k_setup_sects_b         equ bzimage + 0x1f1
@@ -505,12 +1101,18 @@ k_kernel_alignment_d    equ bzimage + 0x230
 k_relocatable_kernel_b  equ bzimage + 0x234
 k_min_alignment_b       equ bzimage + 0x235
 k_pref_address_q        equ bzimage + 0x258
+k_init_size_d           equ bzimage + 0x260
 
 
 align 16
 progend:
 
-READBUF_SIZE equ 4096
+; bytes per INT 21h read, a multiple of 16 so chunks follow on from each
+; other in memory
+READ_CHUNK equ 0xf000
+
+; the most to read before copying up to extended memory
+READBUF_MAX equ READ_CHUNK * 8
 
-readbuf equ progend
-bzimage equ progend + READBUF_SIZE
+job_list equ progend
+bzimage equ progend
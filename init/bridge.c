@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bridge.h"
+#include "mem.h"
+#include "shell.h"
+
+// how often to check on the command if it has no pidfd
+#define BRIDGE_POLL_MS 10
+
+// how long to wait for the command to stop before letting DOS go on anyway
+#define BRIDGE_STOP_MS 5000
+
+typedef struct bridge {
+    pid_t pid;
+    int pidfd;
+    bool exited;
+    bool stopped;
+    uint16_t code;
+
+    // our ends of the command's stdin and stdout pipes, -1 once closed
+    int to_child;
+    int from_child;
+
+    // the command's ends, which it opens through /proc, so they are held
+    // until it exits
+    int child_in;
+    int child_out;
+
+    // the last request, and stdin data from DOS not yet taken by the command
+    uint16_t request;
+    size_t pending_off;
+    size_t pending_len;
+    uint8_t pending[BRIDGE_BUFFER_SIZE];
+}
+bridge_t;
+
+static bridge_t bridge;
+
+static void
+close_fd(int* fd)
+{
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+// makes a pipe with our end nonblocking, returning the path the command
+// opens its end by
+static bool
+open_pipe(int* ours, int* theirs, bool to_child, char* path, size_t path_size)
+{
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC)) {
+        perror("warn: bridge pipe");
+        return false;
+    }
+
+    *ours = to_child ? fds[1] : fds[0];
+    *theirs = to_child ? fds[0] : fds[1];
+
+    fcntl(*ours, F_SETFL, O_NONBLOCK);
+    snprintf(path, path_size, "/proc/%d/fd/%d", getpid(), *theirs);
+    return true;
+}
+
+static void
+bridge_close()
+{
+    close_fd(&bridge.pidfd);
+    close_fd(&bridge.to_child);
+    close_fd(&bridge.from_child);
+    close_fd(&bridge.child_in);
+    close_fd(&bridge.child_out);
+}
+
+// whether any process in group pgid is still running. a SIGSTOP only takes
+// effect once the process leaves the kernel, so one in the middle of a read
+// from disk gets to finish it first
+static bool
+group_running(pid_t pgid)
+{
+    DIR* proc = opendir("/proc");
+
+    if (!proc) {
+        return false;
+    }
+
+    bool running = false;
+    struct dirent* ent;
+
+    while (!running && (ent = readdir(proc))) {
+        char path[32], stat[256];
+        snprintf(path, sizeof(path), "/proc/%s/stat", ent->d_name);
+
+        FILE* file = fopen(path, "re");
+
+        if (!file) {
+            continue;
+        }
+
+        size_t len = fread(stat, 1, sizeof(stat) - 1, file);
+        fclose(file);
+        stat[len] = 0;
+
+        // pid (comm) state ppid pgrp ..., where comm can hold anything
+        char* fields = strrchr(stat, ')');
+        char state;
+        int ppid, pgrp;
+
+        if (fields && sscanf(fields + 1, " %c %d %d", &state, &ppid, &pgrp) == 3) {
+            running = pgrp == pgid && !strchr("tTZX", state);
+        }
+    }
+
+    closedir(proc);
+    return running;
+}
+
+// stops the command and everything it started while DOS has the machine, as
+// DOS services a request with INT 21h on its own drive, or lets it go on
+static void
+freeze(bool stop)
+{
+    if (bridge.exited || bridge.stopped == stop) {
+        return;
+    }
+
+    // the spare shell leads its own process group, see shell.c
+    if (kill(-bridge.pid, stop ? SIGSTOP : SIGCONT)) {
+        perror("warn: bridge kill");
+        return;
+    }
+
+    bridge.stopped = stop;
+
+    for (int ms = 0; stop && group_running(bridge.pid); ms++) {
+        if (ms == BRIDGE_STOP_MS) {
+            fprintf(stderr, "warn: bridged command did not stop\r\n");
+            break;
+        }
+
+        usleep(1000);
+    }
+}
+
+bool
+bridge_start(const char* dir, const char* cmdline, bool in, bool out)
+{
+    // whatever was left stopped by a dsl.com that never came back
+    freeze(false);
+
+    bridge = (bridge_t) {
+        .pidfd = -1,
+        .to_child = -1,
+        .from_child = -1,
+        .child_in = -1,
+        .child_out = -1,
+    };
+
+    char in_path[32], out_path[32];
+    shell_io_t io = { 0 };
+
+    if (in) {
+        if (!open_pipe(&bridge.to_child, &bridge.child_in, true, in_path, sizeof(in_path))) {
+            goto fail;
+        }
+
+        io.in = in_path;
+    }
+
+    if (out) {
+        if (!open_pipe(&bridge.from_child, &bridge.child_out, false, out_path, sizeof(out_path))) {
+            goto fail;
+        }
+
+        io.out = out_path;
+    }
+
+    bridge.pid = shell_run(dir, cmdline, &io);
+
+    if (bridge.pid < 0) {
+        goto fail;
+    }
+
+    bridge.pidfd = shell_pidfd(bridge.pid);
+    return true;
+
+fail:
+    bridge_close();
+    return false;
+}
+
+void
+bridge_result(uint16_t count)
+{
+    freeze(false);
+
+    if (bridge.request != BRIDGE_READ) {
+        return;
+    }
+
+    if (count == 0) {
+        // end of DOS stdin
+        close_fd(&bridge.to_child);
+        return;
+    }
+
+    if (count > BRIDGE_BUFFER_SIZE) {
+        count = BRIDGE_BUFFER_SIZE;
+    }
+
+    memcpy(bridge.pending, linear(BRIDGE_BUFFER_SEG, BRIDGE_BUFFER_OFF), count);
+    bridge.pending_off = 0;
+    bridge.pending_len = count;
+}
+
+static void
+reap()
+{
+    int wstat;
+
+    if (bridge.exited || waitpid(bridge.pid, &wstat, WNOHANG) <= 0) {
+        return;
+    }
+
+    bridge.exited = true;
+    bridge.code = WIFEXITED(wstat) ? WEXITSTATUS(wstat) : 128 + WTERMSIG(wstat);
+
+    // nobody is left to read stdin, and stdout reaches end of file once
+    // anything the command started has let go of it
+    close_fd(&bridge.to_child);
+    close_fd(&bridge.child_in);
+    close_fd(&bridge.child_out);
+    bridge.pending_len = 0;
+}
+
+// feeds the command whatever it will take of the pending stdin data
+static void
+push_input()
+{
+    while (bridge.pending_len && bridge.to_child >= 0) {
+        ssize_t n = write(bridge.to_child, bridge.pending + bridge.pending_off, bridge.pending_len);
+
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+
+        if (n <= 0) {
+            // the command closed its stdin, drop the rest
+            close_fd(&bridge.to_child);
+            bridge.pending_len = 0;
+            return;
+        }
+
+        bridge.pending_off += n;
+        bridge.pending_len -= n;
+    }
+}
+
+void
+bridge_next(uint16_t* request, uint16_t* count)
+{
+    while (1) {
+        push_input();
+
+        // output first, so a command blocked writing stdout can go on
+        if (bridge.from_child >= 0) {
+            ssize_t n = read(bridge.from_child, linear(BRIDGE_BUFFER_SEG, BRIDGE_BUFFER_OFF), BRIDGE_BUFFER_SIZE);
+
+            if (n > 0) {
+                freeze(true);
+                *request = bridge.request = BRIDGE_WRITE;
+                *count = n;
+                return;
+            }
+
+            // after exit, whatever is still holding stdout is not waited for
+            if (n == 0 || errno != EAGAIN || bridge.exited) {
+                close_fd(&bridge.from_child);
+            }
+        }
+
+        // ask DOS for more once the command has taken the last lot
+        if (bridge.to_child >= 0 && bridge.pending_len == 0) {
+            freeze(true);
+            *request = bridge.request = BRIDGE_READ;
+            *count = BRIDGE_BUFFER_SIZE;
+            return;
+        }
+
+        if (bridge.exited && bridge.from_child < 0) {
+            bridge_close();
+            *request = bridge.request = BRIDGE_DONE;
+            *count = bridge.code;
+            return;
+        }
+
+        reap();
+
+        if (bridge.exited) {
+            continue;
+        }
+
+        struct pollfd fds[3];
+        nfds_t nfds = 0;
+
+        if (bridge.pidfd >= 0) {
+            fds[nfds++] = (struct pollfd) { .fd = bridge.pidfd, .events = POLLIN };
+        }
+
+        if (bridge.from_child >= 0) {
+            fds[nfds++] = (struct pollfd) { .fd = bridge.from_child, .events = POLLIN };
+        }
+
+        if (bridge.to_child >= 0 && bridge.pending_len) {
+            fds[nfds++] = (struct pollfd) { .fd = bridge.to_child, .events = POLLOUT };
+        }
+
+        if (poll(fds, nfds, bridge.pidfd >= 0 ? -1 : BRIDGE_POLL_MS) < 0 && errno != EINTR) {
+            perror("warn: bridge poll");
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// streams a linux command's stdin and stdout to and from dsl.com's DOS
+// handles when DOS has them redirected. the VMM and dsl.com take turns: the
+// VMM returns a request, dsl.com does the DOS side of it through the shared
+// buffer and calls back with the result. the command is kept stopped while
+// DOS has a request, as DOS is then using its drive
+
+// shared buffer in the reserved memory above 1M, FFFF:1010 to DOS. the start
+// of the area holds vm86_init_t, see ring.h for the layout
+#define BRIDGE_BUFFER_SEG 0xffff
+#define BRIDGE_BUFFER_OFF 0x1010
+#define BRIDGE_BUFFER_SIZE 0xc000
+
+// requests, in AX
+// the command has exited, exit status in CX
+#define BRIDGE_DONE 0
+// write CX bytes from the buffer to stdout
+#define BRIDGE_WRITE 1
+// read up to CX bytes from stdin into the buffer
+#define BRIDGE_READ 2
+
+// starts cmdline in dir with stdin and/or stdout connected to the bridge
+bool
+bridge_start(const char* dir, const char* cmdline, bool in, bool out);
+
+// takes the byte count from the last BRIDGE_WRITE or BRIDGE_READ, 0 for end
+// of file on stdin
+void
+bridge_result(uint16_t count);
+
+// waits for the next thing DOS needs to do
+void
+bridge_next(uint16_t* request, uint16_t* count);
+
+#endif
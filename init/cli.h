@@ -0,0 +1,26 @@
+#ifndef CLI_H
+#define CLI_H
+
+// runtime state the VMM shares with the command line tools
+#define DSL_RUN_DIR "/run/dsl"
+
+// the init binary doubles as a handful of linux-side tools, picked by the
+// name it is run under. init symlinks each of these into /usr/bin
+
+// types text or BIOS keycodes into DOS
+int
+dslkeys_main(int argc, char** argv);
+
+// shows the VMM's exit counters and timings
+int
+dslstat_main(int argc, char** argv);
+
+// dumps or follows the VMM's trace ring
+int
+dsltrace_main(int argc, char** argv);
+
+// prints messages DOS programs send through the message ring
+int
+dslring_main(int argc, char** argv);
+
+#endif
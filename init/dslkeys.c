@@ -0,0 +1,139 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "kbd.h"
+#include "keys.h"
+
+// keycodes buffered before each write to the socket
+#define BATCH_SIZE 256
+
+#define KEYCODE_ENTER 0x1c0d
+
+static int sock = -1;
+static uint8_t batch[BATCH_SIZE * 2];
+static size_t batch_len;
+
+static void
+usage()
+{
+    fprintf(stderr,
+        "usage: dslkeys [-k keycode | text]...\n"
+        "\n"
+        "types each text argument into DOS, or text from stdin if there are\n"
+        "none. newlines press enter. -k sends a raw BIOS keycode such as\n"
+        "0x3b00 for F1. blocks while DOS is not reading keys fast enough.\n");
+    exit(2);
+}
+
+static void
+flush()
+{
+    size_t off = 0;
+
+    while (off < batch_len) {
+        ssize_t written = write(sock, batch + off, batch_len - off);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("dslkeys: write");
+            exit(1);
+        }
+
+        off += written;
+    }
+
+    batch_len = 0;
+}
+
+static void
+send_keycode(uint16_t keycode)
+{
+    if (batch_len == sizeof(batch)) {
+        flush();
+    }
+
+    batch[batch_len++] = keycode & 0xff;
+    batch[batch_len++] = keycode >> 8;
+}
+
+static void
+send_char(char c)
+{
+    uint16_t keycode = c == '\n' ? KEYCODE_ENTER : kbd_ascii_keycode(c);
+
+    if (!keycode) {
+        fprintf(stderr, "dslkeys: cannot type character 0x%02x\n", (uint8_t)c);
+        exit(1);
+    }
+
+    send_keycode(keycode);
+}
+
+static void
+connect_vmm()
+{
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (sock < 0) {
+        perror("dslkeys: socket");
+        exit(1);
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, KEYS_SOCKET_PATH);
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        perror("dslkeys: connect " KEYS_SOCKET_PATH);
+        exit(1);
+    }
+}
+
+int
+dslkeys_main(int argc, char** argv)
+{
+    connect_vmm();
+
+    if (argc < 2) {
+        int c;
+
+        while ((c = getchar()) != EOF) {
+            send_char(c);
+        }
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0) {
+            if (++i == argc) {
+                usage();
+            }
+
+            char* end;
+            unsigned long keycode = strtoul(argv[i], &end, 0);
+
+            if (*end || keycode > 0xffff) {
+                usage();
+            }
+
+            send_keycode(keycode);
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            usage();
+        } else {
+            for (char* c = argv[i]; *c; c++) {
+                send_char(*c);
+            }
+        }
+    }
+
+    flush();
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "ring.h"
+
+static void
+usage()
+{
+    fprintf(stderr,
+        "usage: dslring [-r]\n"
+        "\n"
+        "receives messages DOS programs write to the message ring and prints\n"
+        "each as its type in decimal, a space, the payload and a newline.\n"
+        "-r prints just the payloads, with nothing in between.\n");
+    exit(2);
+}
+
+int
+dslring_main(int argc, char** argv)
+{
+    int raw = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            raw = 1;
+        } else {
+            usage();
+        }
+    }
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (sock < 0) {
+        perror("dslring: socket");
+        return 1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, RING_SOCKET_PATH);
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        perror("dslring: connect " RING_SOCKET_PATH);
+        return 1;
+    }
+
+    while (1) {
+        uint8_t msg[2 + RING_MAX_PAYLOAD];
+        ssize_t len = recv(sock, msg, sizeof(msg), 0);
+
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (len < 0) {
+            perror("dslring: recv");
+            return 1;
+        }
+
+        if (len == 0) {
+            // VMM went away
+            return 0;
+        }
+
+        if (len < 2) {
+            continue;
+        }
+
+        if (!raw) {
+            printf("%u ", msg[0] | msg[1] << 8);
+        }
+
+        fwrite(msg + 2, 1, len - 2, stdout);
+
+        if (!raw) {
+            putchar('\n');
+        }
+
+        fflush(stdout);
+    }
+}
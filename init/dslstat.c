@@ -0,0 +1,199 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "stats.h"
+
+// rows shown for the INT and port tables unless -a is given
+#define TOP_ROWS 20
+
+typedef struct row {
+    uint32_t key;
+    uint32_t count;
+}
+row_t;
+
+static const char* const exit_names[STATS_EXIT_TYPES] = {
+    "signal", "unknown", "intx", "sti", "picreturn", "5", "trap", "7",
+};
+
+static const stats_t* st;
+static double ticks_per_sec;
+static int rows_shown = TOP_ROWS;
+
+static void
+usage()
+{
+    fprintf(stderr,
+        "usage: dslstat [-a] [-w seconds]\n"
+        "\n"
+        "shows the VMM's exit counters and timings. -a lists every INT and\n"
+        "port rather than the busiest, -w redraws every few seconds.\n");
+    exit(2);
+}
+
+static void
+print_time(double ticks)
+{
+    double secs = ticks / ticks_per_sec;
+
+    if (secs >= 1) {
+        printf("%8.2fs ", secs);
+    } else if (secs >= 1e-3) {
+        printf("%7.2fms ", secs * 1e3);
+    } else if (secs >= 1e-6) {
+        printf("%7.2fus ", secs * 1e6);
+    } else {
+        printf("%7.0fns ", secs * 1e9);
+    }
+}
+
+static void
+print_hist(const char* name, const uint64_t* hist, uint64_t total)
+{
+    printf("\n%s: total ", name);
+    print_time(total);
+    printf("\n");
+
+    for (int i = 0; i < STATS_HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            printf("  >= ");
+            print_time(i ? (double)((uint64_t)1 << i) : 0);
+            printf("%12llu\n", (unsigned long long)hist[i]);
+        }
+    }
+}
+
+static int
+by_count(const void* a, const void* b)
+{
+    const row_t* x = a;
+    const row_t* y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+// sorts the non-zero counters, busiest first. returns how many there are
+static size_t
+top_rows(const uint32_t* counts, size_t len, row_t* rows)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (counts[i]) {
+            rows[n++] = (row_t) { .key = i, .count = counts[i] };
+        }
+    }
+
+    qsort(rows, n, sizeof(rows[0]), by_count);
+    return rows_shown && n > (size_t)rows_shown ? (size_t)rows_shown : n;
+}
+
+static void
+show()
+{
+    uint64_t ns = st->clock_now_ns - st->clock_start_ns;
+    uint64_t ticks = st->clock_now - st->clock_start;
+
+    // until the first timer tick there is nothing to calibrate against
+    ticks_per_sec = ns ? (double)ticks * 1e9 / ns : 1e9;
+
+    printf("uptime %.1fs, clock %s at %.0f MHz\n", ns / 1e9,
+        st->tsc ? "tsc" : "monotonic", ticks_per_sec / 1e6);
+
+    printf("\nexits:\n");
+
+    for (int i = 0; i < STATS_EXIT_TYPES; i++) {
+        if (st->exits[i]) {
+            printf("  %-10s %12llu\n", exit_names[i], (unsigned long long)st->exits[i]);
+        }
+    }
+
+    print_hist("time in guest", st->guest_hist, st->guest_total);
+    print_hist("time in supervisor", st->supervisor_hist, st->supervisor_total);
+
+    printf("\ntime idle: ");
+    print_time(st->idle_total);
+    printf("\n");
+
+    printf("\ninsn cache: %llu hits, %llu misses\n",
+        (unsigned long long)st->insn_cache_hits, (unsigned long long)st->insn_cache_misses);
+    printf("keyboard: %llu keys dropped, %llu scancodes dropped\n",
+        (unsigned long long)st->kbd_dropped_keys, (unsigned long long)st->kbd_output_overflows);
+
+    static row_t rows[0x10000 * 3];
+    size_t n = top_rows(&st->ints[0][0], 256 * 256, rows);
+
+    printf("\nINTs:\n");
+
+    for (size_t i = 0; i < n; i++) {
+        printf("  int %02x ah %02x %12u\n", rows[i].key >> 8, rows[i].key & 0xff, rows[i].count);
+    }
+
+    n = top_rows(&st->ports[0][0], 0x10000 * 3, rows);
+
+    printf("\ntrapped ports:\n");
+
+    for (size_t i = 0; i < n; i++) {
+        printf("  port %04x %c %12u\n", rows[i].key / 3, "bwd"[rows[i].key % 3], rows[i].count);
+    }
+}
+
+int
+dslstat_main(int argc, char** argv)
+{
+    int interval = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "aw:")) != -1) {
+        switch (opt) {
+            case 'a':
+                rows_shown = 0;
+                break;
+            case 'w':
+                interval = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    int fd = open(STATS_PATH, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        perror("dslstat: open " STATS_PATH);
+        return 1;
+    }
+
+    st = mmap(NULL, sizeof(stats_t), PROT_READ, MAP_SHARED, fd, 0);
+
+    if (st == MAP_FAILED) {
+        perror("dslstat: mmap");
+        return 1;
+    }
+
+    if (st->magic != STATS_MAGIC || st->version != STATS_VERSION) {
+        fprintf(stderr, "dslstat: " STATS_PATH " is not a version %d stats file\n", STATS_VERSION);
+        return 1;
+    }
+
+    while (1) {
+        if (interval) {
+            // clear the screen
+            printf("\033[H\033[J");
+        }
+
+        show();
+        fflush(stdout);
+
+        if (!interval) {
+            return 0;
+        }
+
+        sleep(interval);
+    }
+}
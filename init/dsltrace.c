@@ -0,0 +1,187 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "stats.h"
+#include "trace.h"
+
+// how often -f checks for new entries
+#define FOLLOW_INTERVAL_US 100000
+
+static const char* const level_names[] = { "off", "log", "all" };
+
+static const stats_t* st;
+
+static void
+usage()
+{
+    fprintf(stderr,
+        "usage: dsltrace [-f] [-l off|log|all]\n"
+        "\n"
+        "dumps the VMM's trace ring. -f keeps printing new entries as they\n"
+        "come in, -l changes what the VMM traces.\n");
+    exit(2);
+}
+
+static void*
+map(const char* path, size_t size, int prot)
+{
+    int fd = open(path, (prot & PROT_WRITE ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    void* ptr = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    close(fd);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// seconds since the VMM started, if dslstat's clock calibration is there
+static double
+seconds(uint64_t time)
+{
+    if (!st || st->clock_now_ns == st->clock_start_ns) {
+        return 0;
+    }
+
+    double ticks_per_ns = (double)(st->clock_now - st->clock_start)
+        / (st->clock_now_ns - st->clock_start_ns);
+
+    return (time - st->clock_start) / ticks_per_ns / 1e9;
+}
+
+static char
+width_suffix(uint8_t width)
+{
+    switch (width) {
+        case 1: return 'b';
+        case 2: return 'w';
+        default: return 'd';
+    }
+}
+
+static void
+print_entry(const trace_entry_t* entry)
+{
+    printf("%12.6f %04x:%04x ", seconds(entry->time), entry->cs, entry->ip);
+
+    switch (entry->type) {
+        case TRACE_IN:
+        case TRACE_OUT:
+            printf("%s%c %04x %0*x\n", entry->type == TRACE_IN ? "in" : "out",
+                width_suffix(entry->width), entry->arg, entry->width * 2, entry->value);
+            break;
+        case TRACE_INS:
+        case TRACE_OUTS:
+            printf("%s%c %04x count %u\n", entry->type == TRACE_INS ? "ins" : "outs",
+                width_suffix(entry->width), entry->arg, entry->value);
+            break;
+        case TRACE_INT:
+        case TRACE_INT_UNKNOWN:
+            printf("int %02x ax %04x%s\n", entry->arg, entry->value,
+                entry->type == TRACE_INT_UNKNOWN ? " unhandled" : "");
+            break;
+        case TRACE_IRQ:
+            printf("irq vector %02x\n", entry->arg);
+            break;
+        case TRACE_STI:
+            printf("sti\n");
+            break;
+        default:
+            printf("unknown entry type %u\n", entry->type);
+            break;
+    }
+}
+
+// prints entries from tail up to the current head, returns the new tail
+static uint32_t
+dump(const trace_ring_t* ring, uint32_t tail)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head - tail > TRACE_ENTRIES) {
+        if (tail) {
+            printf("... %u entries lost\n", head - tail - TRACE_ENTRIES);
+        }
+
+        tail = head - TRACE_ENTRIES;
+    }
+
+    for (; tail != head; tail++) {
+        trace_entry_t entry = ring->ring[tail % TRACE_ENTRIES];
+
+        // the VMM may have lapped us while we copied the entry
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail >= TRACE_ENTRIES) {
+            continue;
+        }
+
+        print_entry(&entry);
+    }
+
+    return tail;
+}
+
+int
+dsltrace_main(int argc, char** argv)
+{
+    int follow = 0;
+    int level = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "fl:")) != -1) {
+        switch (opt) {
+            case 'f':
+                follow = 1;
+                break;
+            case 'l':
+                for (size_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++) {
+                    if (strcmp(optarg, level_names[i]) == 0) {
+                        level = i;
+                    }
+                }
+
+                if (level < 0) {
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+
+    trace_ring_t* ring = map(TRACE_PATH, sizeof(trace_ring_t),
+        PROT_READ | (level >= 0 ? PROT_WRITE : 0));
+
+    if (!ring) {
+        perror("dsltrace: map " TRACE_PATH);
+        return 1;
+    }
+
+    if (ring->magic != TRACE_MAGIC || ring->version != TRACE_VERSION) {
+        fprintf(stderr, "dsltrace: " TRACE_PATH " is not a version %d trace file\n", TRACE_VERSION);
+        return 1;
+    }
+
+    if (level >= 0) {
+        ring->level = level;
+        return 0;
+    }
+
+    st = map(STATS_PATH, sizeof(stats_t), PROT_READ);
+
+    uint32_t tail = dump(ring, 0);
+
+    while (follow) {
+        fflush(stdout);
+        usleep(FOLLOW_INTERVAL_US);
+        tail = dump(ring, tail);
+    }
+
+    return 0;
+}
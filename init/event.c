@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "panic.h"
+
+#define MAX_WATCHES 32
+#define MAX_EVENTS 16
+
+// signal used to knock the VMM out of vm86 mode
+#define KICK_SIGNAL SIGUSR1
+
+// how long the kick thread waits for the VMM to leave the guest before
+// kicking again. a kick that lands just before SYS_vm86 enters the guest is
+// lost, this bounds how long an event can then sit unnoticed
+#define KICK_RETRY_MS 2
+
+typedef struct watch {
+    // -1 when the slot is free
+    int fd;
+    event_fn fn;
+    void* ctx;
+}
+watch_t;
+
+typedef struct signal_handler {
+    event_signal_fn fn;
+    void* ctx;
+}
+signal_handler_t;
+
+static int epfd = -1;
+static int sigfd = -1;
+static sigset_t sigfd_mask;
+
+static watch_t watches[MAX_WATCHES];
+static signal_handler_t signal_handlers[_NSIG];
+
+static pthread_t vmm_thread;
+
+// shared with the kick thread
+static atomic_bool in_guest;
+static atomic_bool ready;
+
+static void
+on_kick(int sig)
+{
+    // only here to knock the VMM out of vm86 mode
+    (void)sig;
+}
+
+// sleeps on the VMM's epoll set and interrupts the VMM thread when anything
+// in it becomes ready while the guest is running
+static void*
+kick_thread(void* arg)
+{
+    (void)arg;
+
+    int kick_epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (kick_epfd < 0) {
+        fatal("epoll_create1");
+    }
+
+    // edge triggered, so we wake once per new event rather than spinning
+    // until the VMM gets around to dispatching it
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET };
+
+    if (epoll_ctl(kick_epfd, EPOLL_CTL_ADD, epfd, &ev)) {
+        fatal("epoll_ctl");
+    }
+
+    bool kicking = false;
+
+    while (1) {
+        int rc = epoll_wait(kick_epfd, &ev, 1, kicking ? KICK_RETRY_MS : -1);
+
+        if (rc < 0 && errno != EINTR) {
+            fatal("epoll_wait");
+        }
+
+        if (rc > 0) {
+            atomic_store(&ready, true);
+        }
+
+        // the VMM checks ready after setting in_guest, and we check in_guest
+        // after setting ready, so if we see it outside the guest it is
+        // guaranteed to notice the event before going back in
+        kicking = atomic_load(&ready) && atomic_load(&in_guest);
+
+        if (kicking) {
+            pthread_kill(vmm_thread, KICK_SIGNAL);
+        }
+    }
+}
+
+static void
+on_signalfd(void* ctx, uint32_t events)
+{
+    (void)ctx;
+    (void)events;
+
+    struct signalfd_siginfo info;
+
+    while (read(sigfd, &info, sizeof(info)) == sizeof(info)) {
+        signal_handler_t* handler = &signal_handlers[info.ssi_signo];
+
+        if (handler->fn) {
+            handler->fn(handler->ctx, info.ssi_signo);
+        }
+    }
+}
+
+void
+event_init()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epfd < 0) {
+        fatal("epoll_create1");
+    }
+
+    for (int i = 0; i < MAX_WATCHES; i++) {
+        watches[i].fd = -1;
+    }
+
+    sigemptyset(&sigfd_mask);
+    sigfd = signalfd(-1, &sigfd_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if (sigfd < 0) {
+        fatal("signalfd");
+    }
+
+    event_add(sigfd, EPOLLIN, on_signalfd, NULL);
+
+    // SA_RESTART so the kick does not break blocking calls the supervisor
+    // makes, vm86 mode is left regardless
+    struct sigaction sa = { 0 };
+    sa.sa_handler = on_kick;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(KICK_SIGNAL, &sa, NULL)) {
+        fatal("sigaction kick");
+    }
+
+    vmm_thread = pthread_self();
+
+    // the kick thread must not take any signals meant for the VMM
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, kick_thread, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc) {
+        errno = rc;
+        fatal("pthread_create");
+    }
+}
+
+void
+event_add(int fd, uint32_t events, event_fn fn, void* ctx)
+{
+    watch_t* watch = NULL;
+
+    for (int i = 0; i < MAX_WATCHES; i++) {
+        if (watches[i].fd < 0) {
+            watch = &watches[i];
+            break;
+        }
+    }
+
+    if (!watch) {
+        panic("too many event watches");
+    }
+
+    watch->fd = fd;
+    watch->fn = fn;
+    watch->ctx = ctx;
+
+    struct epoll_event ev = { .events = events, .data.ptr = watch };
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        fatal("epoll_ctl add");
+    }
+}
+
+static watch_t*
+find_watch(int fd)
+{
+    for (int i = 0; i < MAX_WATCHES; i++) {
+        if (watches[i].fd == fd) {
+            return &watches[i];
+        }
+    }
+
+    panic("fd not watched");
+}
+
+void
+event_modify(int fd, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = find_watch(fd) };
+
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev)) {
+        fatal("epoll_ctl mod");
+    }
+}
+
+void
+event_del(int fd)
+{
+    watch_t* watch = find_watch(fd);
+
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL)) {
+        fatal("epoll_ctl del");
+    }
+
+    // an event for this fd already fetched by event_dispatch is skipped, but
+    // if the slot is reused in the meantime the new owner may see a spurious
+    // wakeup. handlers all read non-blocking so that is harmless
+    watch->fd = -1;
+}
+
+void
+event_add_signal(int signo, event_signal_fn fn, void* ctx)
+{
+    signal_handlers[signo] = (signal_handler_t) { .fn = fn, .ctx = ctx };
+
+    sigaddset(&sigfd_mask, signo);
+
+    if (pthread_sigmask(SIG_BLOCK, &sigfd_mask, NULL)) {
+        fatal("pthread_sigmask");
+    }
+
+    if (signalfd(sigfd, &sigfd_mask, 0) < 0) {
+        fatal("signalfd");
+    }
+}
+
+void
+event_dispatch(int timeout_ms)
+{
+    // clear before waiting so anything arriving from here on is picked up
+    // on the next exit
+    atomic_store(&ready, false);
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+
+    if (count < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+
+        fatal("epoll_wait");
+    }
+
+    if (count == MAX_EVENTS) {
+        // there may be more, come back on the next exit
+        atomic_store(&ready, true);
+    }
+
+    for (int i = 0; i < count; i++) {
+        watch_t* watch = events[i].data.ptr;
+
+        if (watch->fd >= 0) {
+            watch->fn(watch->ctx, events[i].events);
+        }
+    }
+}
+
+bool
+event_enter_guest()
+{
+    atomic_store(&in_guest, true);
+
+    if (atomic_load(&ready)) {
+        atomic_store(&in_guest, false);
+        return false;
+    }
+
+    return true;
+}
+
+void
+event_leave_guest()
+{
+    atomic_store(&in_guest, false);
+}
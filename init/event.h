@@ -0,0 +1,48 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// called with the epoll events that fired for the fd
+typedef void (*event_fn)(void* ctx, uint32_t events);
+
+// called with the signal number read from the signalfd
+typedef void (*event_signal_fn)(void* ctx, int signo);
+
+// creates the epoll set and signalfd and starts the kick thread. must be
+// called on the thread that runs the guest
+void
+event_init();
+
+// watches fd for events (EPOLLIN etc), calling fn from event_dispatch
+void
+event_add(int fd, uint32_t events, event_fn fn, void* ctx);
+
+// changes the events watched on fd, eg. to stop reading while a queue is full
+void
+event_modify(int fd, uint32_t events);
+
+void
+event_del(int fd);
+
+// blocks signo and delivers it through the signalfd instead, calling fn from
+// event_dispatch
+void
+event_add_signal(int signo, event_signal_fn fn, void* ctx);
+
+// runs handlers for ready fds, waiting up to timeout_ms for one (-1 forever,
+// 0 to just check)
+void
+event_dispatch(int timeout_ms);
+
+// bracket SYS_vm86 so the kick thread knows whether a signal is needed to get
+// the VMM out of the guest. returns false without entering if events came in
+// meanwhile, in which case the caller should dispatch them first
+bool
+event_enter_guest();
+
+void
+event_leave_guest();
+
+#endif
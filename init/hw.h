@@ -0,0 +1,68 @@
+#ifndef HW_H
+#define HW_H
+
+// real port I/O for the supervisor. host builds of the VMM (DSL_HOST, see
+// test/) have no hardware to talk to, so these go to the harness's mock port
+// bus instead
+
+#ifdef DSL_HOST
+
+#include <stdint.h>
+
+uint32_t
+host_port_in(uint16_t port, uint16_t width);
+
+void
+host_port_out(uint16_t port, uint16_t width, uint32_t value);
+
+static inline uint8_t inb(uint16_t port) { return host_port_in(port, 1); }
+static inline uint16_t inw(uint16_t port) { return host_port_in(port, 2); }
+static inline uint32_t inl(uint16_t port) { return host_port_in(port, 4); }
+
+static inline void outb(uint8_t value, uint16_t port) { host_port_out(port, 1, value); }
+static inline void outw(uint16_t value, uint16_t port) { host_port_out(port, 2, value); }
+static inline void outl(uint32_t value, uint16_t port) { host_port_out(port, 4, value); }
+
+static inline void
+host_port_in_string(uint16_t port, uint16_t width, void* buf, uint32_t count)
+{
+    for (uint8_t* ptr = buf; count; count--, ptr += width) {
+        uint32_t value = host_port_in(port, width);
+        __builtin_memcpy(ptr, &value, width);
+    }
+}
+
+static inline void
+host_port_out_string(uint16_t port, uint16_t width, const void* buf, uint32_t count)
+{
+    for (const uint8_t* ptr = buf; count; count--, ptr += width) {
+        uint32_t value = 0;
+        __builtin_memcpy(&value, ptr, width);
+        host_port_out(port, width, value);
+    }
+}
+
+static inline void insb(uint16_t port, void* buf, uint32_t count) { host_port_in_string(port, 1, buf, count); }
+static inline void insw(uint16_t port, void* buf, uint32_t count) { host_port_in_string(port, 2, buf, count); }
+static inline void insl(uint16_t port, void* buf, uint32_t count) { host_port_in_string(port, 4, buf, count); }
+
+static inline void outsb(uint16_t port, const void* buf, uint32_t count) { host_port_out_string(port, 1, buf, count); }
+static inline void outsw(uint16_t port, const void* buf, uint32_t count) { host_port_out_string(port, 2, buf, count); }
+static inline void outsl(uint16_t port, const void* buf, uint32_t count) { host_port_out_string(port, 4, buf, count); }
+
+static inline int
+ioperm(unsigned long from, unsigned long num, int turn_on)
+{
+    (void)from;
+    (void)num;
+    (void)turn_on;
+    return 0;
+}
+
+#else
+
+#include <sys/io.h>
+
+#endif
+
+#endif
@@ -6,17 +6,29 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <linux/magic.h>
 // #include <sys/vm86.h>
 
+#include "cli.h"
 #include "vm86.h"
 #include "panic.h"
+#include "rootfs.h"
+#include "vfat.h"
+
+// where this binary ends up once the hard drive is moved to /mnt/c
+#define INIT_PATH "/mnt/c/doslinux/init"
+
+// the DOS drive, same as root= on the command line dsl.com passes
+#define DOS_DRIVE "/dev/sda1"
 
 #define CHECKED(expr) { if ((rc = (expr)) < 0) { goto out; } }
 
@@ -79,16 +91,33 @@ int install_busybox() {
     }
 }
 
+// booted from the initramfs dsl.com loads, which already has everything else
+// in place (see script/mkinitramfs)
+void initialize_initramfs() {
+    if (mount("", "/proc", "proc", 0, NULL)) {
+        fatal("mount /proc");
+    }
+
+    // see vfat.h for how writes are kept coherent with DOS
+    if (mount(DOS_DRIVE, VFAT_MOUNT, "vfat", vfat_mount_flags(), NULL)) {
+        fatal("mount " DOS_DRIVE);
+    }
+
+    // the rest of the root filesystem lives on the DOS drive if it's there
+    rootfs_switch();
+}
+
+// booted with the DOS drive as root because there was no initramfs, build a
+// root filesystem in ramfs and move the drive to /mnt/c
 void initialize() {
-    // remount hard drive as rw and sync
-    // sync is needed so that linux does not defer disk writes and MS-DOS can
-    // see them immediately
-    if (mount("", "/", "vfat", MS_REMOUNT | MS_SYNCHRONOUS, NULL)) {
+    // remount hard drive as rw, see vfat.h for how writes are kept coherent
+    // with DOS
+    if (mount("", "/", "vfat", MS_REMOUNT | vfat_mount_flags(), NULL)) {
         fatal("remount root");
     }
 
-    // setup ramdisk for root partition
-    // TODO - maybe a persistent ext4 fs on a loop device?
+    // setup ramdisk for root partition, the persistent one (see rootfs.h) is
+    // only used when booting from the initramfs
 
     if (mount("", "/doslinux/rootfs", "ramfs", 0, NULL)) {
         fatal("mount ramfs");
@@ -150,6 +179,34 @@ void initialize() {
         fatal("install busybox");
     }
 
+    // the tools built into init, see cli.h
+
+    if (symlink(INIT_PATH, "/usr/bin/dslkeys")) {
+        fatal("symlink dslkeys");
+    }
+
+    if (symlink(INIT_PATH, "/usr/bin/dslstat")) {
+        fatal("symlink dslstat");
+    }
+
+    if (symlink(INIT_PATH, "/usr/bin/dsltrace")) {
+        fatal("symlink dsltrace");
+    }
+
+    if (symlink(INIT_PATH, "/usr/bin/dslring")) {
+        fatal("symlink dslring");
+    }
+
+    // runtime state shared between the VMM and the tools
+
+    if (mkdir("/run", 0755)) {
+        fatal("mkdir /run");
+    }
+
+    if (mkdir(DSL_RUN_DIR, 0755)) {
+        fatal("mkdir " DSL_RUN_DIR);
+    }
+
     // setup /dev
 
     if (mkdir("/dev", 0755)) {
@@ -205,8 +262,38 @@ out:
     return rc;
 }
 
-int main() {
-    initialize();
+int main(int argc, char** argv) {
+    // run as one of the tools rather than as init
+    const char* name = strrchr(argv[0], '/');
+    name = name ? name + 1 : argv[0];
+
+    if (strcmp(name, "dslkeys") == 0) {
+        return dslkeys_main(argc, argv);
+    }
+
+    if (strcmp(name, "dslstat") == 0) {
+        return dslstat_main(argc, argv);
+    }
+
+    if (strcmp(name, "dsltrace") == 0) {
+        return dsltrace_main(argc, argv);
+    }
+
+    if (strcmp(name, "dslring") == 0) {
+        return dslring_main(argc, argv);
+    }
+
+    struct statfs root;
+
+    if (statfs("/", &root)) {
+        fatal("statfs /");
+    }
+
+    if (root.f_type == MSDOS_SUPER_MAGIC) {
+        initialize();
+    } else {
+        initialize_initramfs();
+    }
 
     printf(" ok\n");
 
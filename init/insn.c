@@ -0,0 +1,430 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "insn.h"
+#include "mem.h"
+#include "panic.h"
+#include "port.h"
+#include "stats.h"
+
+// the architectural limit, anything longer raises #UD on real hardware
+#define MAX_INSN_LEN 15
+
+enum prefix {
+    PFX_NONE = 0,
+    PFX_SEG,
+    PFX_OPSIZE,
+    PFX_ADSIZE,
+    PFX_LOCK,
+    PFX_REPNE,
+    PFX_REP,
+};
+
+enum rep_kind {
+    NONE,
+    REP,
+    REPNE,
+};
+
+enum bit_size {
+    BITS16 = 0,
+    BITS32 = 1,
+};
+
+// decoder state for one faulting instruction
+typedef struct insn {
+    // segment override prefix byte, or 0 for none
+    uint8_t seg;
+    enum bit_size operand;
+    enum bit_size address;
+    enum rep_kind rep;
+    bool lock;
+
+    uint8_t opcode;
+    // zero extended immediate operand, if the instruction has one
+    uint32_t imm;
+    // total length including prefixes and immediate
+    uint8_t len;
+}
+insn_t;
+
+typedef void (*insn_handler_t)(task_t* task, const insn_t* insn);
+
+// resolves the data segment for an instruction, honouring any override
+static uint16_t
+data_segment(regs_t* regs, const insn_t* insn)
+{
+    switch (insn->seg) {
+        case 0x26: return regs->es16.word.lo;
+        case 0x2e: return regs->cs.word.lo;
+        case 0x36: return regs->ss.word.lo;
+        case 0x64: return regs->fs16.word.lo;
+        case 0x65: return regs->gs16.word.lo;
+        default: return regs->ds16.word.lo;
+    }
+}
+
+static void
+advance_index(reg32_t* index, enum bit_size address, int32_t delta)
+{
+    if (address == BITS32) {
+        index->dword += delta;
+    } else {
+        index->word.lo += delta;
+    }
+}
+
+// emulates INS/OUTS of any width, with or without REP. the whole transfer is
+// checked once and then done with a single native string instruction
+// straight into DOS memory where possible, rather than element by element
+static void
+do_string_io(task_t* task, const insn_t* insn, bool out, uint16_t width)
+{
+    regs_t* regs = task->regs;
+    uint16_t port = regs->edx.word.lo;
+    enum bit_size address = insn->address;
+
+    // INS always stores to ES:DI, OUTS loads from DS:SI but DS can be
+    // overridden
+    reg32_t* index = out ? &regs->esi : &regs->edi;
+    uint16_t segment = out ? data_segment(regs, insn) : regs->es16.word.lo;
+
+    // string I/O does not test ZF, so REPNE repeats just like REP
+    uint32_t count = 1;
+
+    if (insn->rep != NONE) {
+        count = address == BITS32 ? regs->ecx.dword : regs->ecx.word.lo;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t offset = address == BITS32 ? index->dword : index->word.lo;
+    uint64_t bytes = (uint64_t)count * width;
+
+    if (!(regs->eflags.dword & FLAG_DIRECTION) && offset + bytes <= 0x10000) {
+        // fast path: ascending and does not wrap around the segment
+        void* buf = linear(segment, offset);
+
+        if (out) {
+            port_out_string(regs, port, width, buf, count);
+        } else {
+            port_in_string(regs, port, width, buf, count);
+        }
+
+        advance_index(index, address, bytes);
+    } else {
+        // slow path: descending or wrapping, go one element at a time
+        int32_t step = regs->eflags.dword & FLAG_DIRECTION ? -width : width;
+
+        for (; count; count--) {
+            offset = address == BITS32 ? index->dword : index->word.lo;
+
+            if (offset > 0xffff) {
+                panic("string I/O outside of segment limit");
+            }
+
+            void* buf = linear(segment, offset);
+
+            if (out) {
+                port_out_string(regs, port, width, buf, 1);
+            } else {
+                port_in_string(regs, port, width, buf, 1);
+            }
+
+            advance_index(index, address, step);
+        }
+    }
+
+    if (insn->rep != NONE) {
+        if (address == BITS32) {
+            regs->ecx.dword = 0;
+        } else {
+            regs->ecx.word.lo = 0;
+        }
+    }
+}
+
+static void
+insn_insb(task_t* task, const insn_t* insn)
+{
+    do_string_io(task, insn, false, 1);
+}
+
+static void
+insn_insw(task_t* task, const insn_t* insn)
+{
+    do_string_io(task, insn, false, 2);
+}
+
+static void
+insn_insd(task_t* task, const insn_t* insn)
+{
+    do_string_io(task, insn, false, 4);
+}
+
+static void
+insn_outsb(task_t* task, const insn_t* insn)
+{
+    do_string_io(task, insn, true, 1);
+}
+
+static void
+insn_outsw(task_t* task, const insn_t* insn)
+{
+    do_string_io(task, insn, true, 2);
+}
+
+static void
+insn_outsd(task_t* task, const insn_t* insn)
+{
+    do_string_io(task, insn, true, 4);
+}
+
+static void
+insn_inb_imm(task_t* task, const insn_t* insn)
+{
+    task->regs->eax.byte.lo = port_in(task->regs, insn->imm, 1);
+}
+
+static void
+insn_inw_imm(task_t* task, const insn_t* insn)
+{
+    task->regs->eax.word.lo = port_in(task->regs, insn->imm, 2);
+}
+
+static void
+insn_ind_imm(task_t* task, const insn_t* insn)
+{
+    task->regs->eax.dword = port_in(task->regs, insn->imm, 4);
+}
+
+static void
+insn_outb_imm(task_t* task, const insn_t* insn)
+{
+    port_out(task->regs, insn->imm, 1, task->regs->eax.byte.lo);
+}
+
+static void
+insn_outw_imm(task_t* task, const insn_t* insn)
+{
+    port_out(task->regs, insn->imm, 2, task->regs->eax.word.lo);
+}
+
+static void
+insn_outd_imm(task_t* task, const insn_t* insn)
+{
+    port_out(task->regs, insn->imm, 4, task->regs->eax.dword);
+}
+
+static void
+insn_inb_dx(task_t* task, const insn_t* insn)
+{
+    (void)insn;
+    task->regs->eax.byte.lo = port_in(task->regs, task->regs->edx.word.lo, 1);
+}
+
+static void
+insn_inw_dx(task_t* task, const insn_t* insn)
+{
+    (void)insn;
+    task->regs->eax.word.lo = port_in(task->regs, task->regs->edx.word.lo, 2);
+}
+
+static void
+insn_ind_dx(task_t* task, const insn_t* insn)
+{
+    (void)insn;
+    task->regs->eax.dword = port_in(task->regs, task->regs->edx.word.lo, 4);
+}
+
+static void
+insn_outb_dx(task_t* task, const insn_t* insn)
+{
+    (void)insn;
+    port_out(task->regs, task->regs->edx.word.lo, 1, task->regs->eax.byte.lo);
+}
+
+static void
+insn_outw_dx(task_t* task, const insn_t* insn)
+{
+    (void)insn;
+    port_out(task->regs, task->regs->edx.word.lo, 2, task->regs->eax.word.lo);
+}
+
+static void
+insn_outd_dx(task_t* task, const insn_t* insn)
+{
+    (void)insn;
+    port_out(task->regs, task->regs->edx.word.lo, 4, task->regs->eax.dword);
+}
+
+static void
+insn_hlt(task_t* task, const insn_t* insn)
+{
+    (void)insn;
+
+    if (!(task->regs->eflags.dword & FLAG_VIF)) {
+        panic("8086 task halted CPU with interrupts disabled");
+    }
+
+    // sleep until the next event once we are back in the VMM loop
+    task->halted = true;
+}
+
+static const struct insn_entry {
+    enum prefix prefix;
+    uint8_t imm_len;
+    insn_handler_t handler[2];
+}
+insn_table[256] = {
+#define PREFIX(byte, kind) \
+    [byte] = { .prefix = kind },
+#define INSN(byte, imm, handler16, handler32) \
+    [byte] = { .imm_len = imm, .handler = { insn_##handler16, insn_##handler32 } },
+#include "insn.def"
+#undef PREFIX
+#undef INSN
+};
+
+static void
+unknown_insn(task_t* task, const char* why)
+{
+    printf("[%04x:%04x] %s in gpf: %02x\n",
+        task->regs->cs.word.lo,
+        task->regs->eip.word.lo,
+        why,
+        peekip(task->regs, 0));
+    halt();
+}
+
+// decodes the instruction at CS:IP into insn and returns its handler
+static insn_handler_t
+decode_insn(task_t* task, insn_t* insn)
+{
+    const struct insn_entry* entry;
+
+    // consume prefixes and the opcode in a single pass
+    for (;; insn->len++) {
+        if (insn->len == MAX_INSN_LEN) {
+            unknown_insn(task, "overlong instruction");
+        }
+
+        insn->opcode = peekip(task->regs, insn->len);
+        entry = &insn_table[insn->opcode];
+
+        switch (entry->prefix) {
+            case PFX_SEG:
+                insn->seg = insn->opcode;
+                continue;
+            case PFX_OPSIZE:
+                insn->operand = BITS32;
+                continue;
+            case PFX_ADSIZE:
+                insn->address = BITS32;
+                continue;
+            case PFX_LOCK:
+                insn->lock = true;
+                continue;
+            case PFX_REPNE:
+                insn->rep = REPNE;
+                continue;
+            case PFX_REP:
+                insn->rep = REP;
+                continue;
+            case PFX_NONE:
+                break;
+        }
+
+        break;
+    }
+
+    insn->len++;
+
+    insn_handler_t handler = entry->handler[insn->operand];
+
+    if (handler == NULL) {
+        unknown_insn(task, "unknown instruction");
+    }
+
+    // none of the instructions we emulate accept LOCK, it raises #UD
+    if (insn->lock) {
+        unknown_insn(task, "LOCK prefixed instruction");
+    }
+
+    for (uint8_t i = 0; i < entry->imm_len; i++) {
+        insn->imm |= (uint32_t)peekip(task->regs, insn->len++) << (i * 8);
+    }
+
+    return handler;
+}
+
+// DOS drivers tend to fault on the same few IN/OUT instructions over and
+// over, so decoded instructions are cached by linear address. an entry is
+// only used if the bytes at that address still match what was decoded, which
+// also covers self-modifying code and overlays loaded over old code
+
+#define INSN_CACHE_SIZE 256
+
+// only instructions up to this long are cached, so that the bytes can be
+// compared with a single 64 bit load
+#define INSN_CACHE_MAX_LEN 8
+
+struct insn_cache_entry {
+    insn_handler_t handler;
+    uint32_t lin;
+    uint64_t bytes;
+    uint64_t mask;
+    insn_t insn;
+};
+
+static struct insn_cache_entry insn_cache[INSN_CACHE_SIZE];
+
+static uint64_t
+load64(const void* ptr)
+{
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+void
+emulate_insn(task_t* task)
+{
+    regs_t* regs = task->regs;
+    uint16_t ip = regs->eip.word.lo;
+
+    // the bytes compared must not wrap around the end of the code segment
+    bool cacheable = ip <= 0x10000 - INSN_CACHE_MAX_LEN;
+
+    const void* code = linear(regs->cs.word.lo, ip);
+    uint32_t lin = (uintptr_t)code;
+    struct insn_cache_entry* entry = &insn_cache[(lin ^ (lin >> 8)) % INSN_CACHE_SIZE];
+
+    if (cacheable && entry->handler != NULL && entry->lin == lin
+            && (load64(code) & entry->mask) == entry->bytes) {
+        stats->insn_cache_hits++;
+        entry->handler(task, &entry->insn);
+        regs->eip.word.lo += entry->insn.len;
+        return;
+    }
+
+    stats->insn_cache_misses++;
+
+    insn_t insn = { 0 };
+    insn_handler_t handler = decode_insn(task, &insn);
+
+    if (cacheable && insn.len <= INSN_CACHE_MAX_LEN) {
+        entry->handler = handler;
+        entry->lin = lin;
+        entry->mask = insn.len == 8 ? ~0ull : (1ull << (insn.len * 8)) - 1;
+        entry->bytes = load64(code) & entry->mask;
+        entry->insn = insn;
+    }
+
+    handler(task, &insn);
+    regs->eip.word.lo += insn.len;
+}
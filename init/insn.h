@@ -0,0 +1,12 @@
+#ifndef INSN_H
+#define INSN_H
+
+#include <stdint.h>
+
+#include "task.h"
+
+// emulates the instruction at CS:IP that caused a GPF and advances IP past it
+void
+emulate_insn(task_t* task);
+
+#endif
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "jobs.h"
+#include "panic.h"
+#include "rootfs.h"
+#include "shell.h"
+
+// how often to check on a job whose pidfd could not be opened
+#define JOB_POLL_MS 100
+
+typedef struct job {
+    // 0 when the slot is free
+    uint16_t id;
+    uint16_t state;
+    uint16_t code;
+    pid_t pid;
+    // in the event loop while running, -1 otherwise
+    int pidfd;
+}
+job_t;
+
+static job_t jobs[JOB_MAX];
+static uint16_t next_id = 1;
+
+// collects the job's exit status if it has exited
+static void
+reap(job_t* job)
+{
+    if (job->state != JOB_RUNNING) {
+        return;
+    }
+
+    int wstat;
+
+    if (waitpid(job->pid, &wstat, WNOHANG) <= 0) {
+        return;
+    }
+
+    job->state = JOB_EXITED;
+    job->code = WIFEXITED(wstat) ? WEXITSTATUS(wstat) : 128 + WTERMSIG(wstat);
+
+    if (job->pidfd >= 0) {
+        event_del(job->pidfd);
+        close(job->pidfd);
+        job->pidfd = -1;
+    }
+}
+
+static void
+on_job_exit(void* ctx, uint32_t events)
+{
+    (void)events;
+    reap(ctx);
+}
+
+static job_t*
+find(uint16_t id)
+{
+    for (int i = 0; i < JOB_MAX; i++) {
+        if (jobs[i].id != 0 && jobs[i].id == id) {
+            return &jobs[i];
+        }
+    }
+
+    return NULL;
+}
+
+// a free slot, or the slot of the longest exited job nobody waited for
+static job_t*
+alloc_slot()
+{
+    job_t* oldest = NULL;
+
+    for (int i = 0; i < JOB_MAX; i++) {
+        job_t* job = &jobs[i];
+
+        if (job->id == 0) {
+            return job;
+        }
+
+        reap(job);
+
+        if (job->state == JOB_EXITED && (!oldest || (uint16_t)(job->id - oldest->id) > 0x8000)) {
+            oldest = job;
+        }
+    }
+
+    return oldest;
+}
+
+void
+jobs_init()
+{
+    if (mkdir(JOBS_DIR, 0755) && errno != EEXIST) {
+        fatal("mkdir " JOBS_DIR);
+    }
+
+    for (int i = 0; i < JOB_MAX; i++) {
+        jobs[i].pidfd = -1;
+    }
+}
+
+uint16_t
+jobs_start(const char* cmdline)
+{
+    // with / on the DOS drive, merely running a program reads from the disk
+    // under DOS's feet, and nothing keeps a job from doing so while DOS runs
+    if (rootfs_on_disk()) {
+        fprintf(stderr, "warn: no background jobs with / on the DOS drive\r\n");
+        return 0;
+    }
+
+    job_t* job = alloc_slot();
+
+    if (!job) {
+        fprintf(stderr, "warn: too many background jobs\r\n");
+        return 0;
+    }
+
+    uint16_t id = next_id++;
+
+    if (next_id == 0) {
+        next_id = 1;
+    }
+
+    char log[64];
+    snprintf(log, sizeof(log), JOBS_DIR "/%u.log", id);
+
+    shell_io_t io = {
+        .in = "/dev/null",
+        .out = log,
+        .err_to_out = true,
+    };
+
+    pid_t pid = shell_run(JOBS_DIR, cmdline, &io);
+
+    if (pid < 0) {
+        return 0;
+    }
+
+    *job = (job_t) {
+        .id = id,
+        .state = JOB_RUNNING,
+        .pid = pid,
+        .pidfd = shell_pidfd(pid),
+    };
+
+    if (job->pidfd < 0) {
+        perror("warn: pidfd_open");
+    } else {
+        event_add(job->pidfd, EPOLLIN, on_job_exit, job);
+    }
+
+    return id;
+}
+
+bool
+jobs_status(uint16_t id, uint16_t* state, uint16_t* code)
+{
+    job_t* job = find(id);
+
+    if (!job) {
+        return false;
+    }
+
+    reap(job);
+    *state = job->state;
+    *code = job->code;
+    return true;
+}
+
+bool
+jobs_wait(uint16_t* id, uint16_t* code)
+{
+    while (1) {
+        bool any = false;
+        bool polling = false;
+
+        for (int i = 0; i < JOB_MAX; i++) {
+            job_t* job = &jobs[i];
+
+            if (job->id == 0 || (*id != 0 && job->id != *id)) {
+                continue;
+            }
+
+            reap(job);
+
+            if (job->state == JOB_EXITED) {
+                *id = job->id;
+                *code = job->code;
+                job->id = 0;
+                return true;
+            }
+
+            any = true;
+            polling |= job->pidfd < 0;
+        }
+
+        if (!any) {
+            return false;
+        }
+
+        // sleep until something exits, keyboard input and timer ticks for
+        // DOS keep being queued meanwhile
+        event_dispatch(polling ? JOB_POLL_MS : -1);
+    }
+}
+
+uint16_t
+jobs_list(job_info_t* infos, uint16_t max)
+{
+    uint16_t count = 0;
+
+    for (int i = 0; i < JOB_MAX && count < max; i++) {
+        job_t* job = &jobs[i];
+
+        if (job->id == 0) {
+            continue;
+        }
+
+        reap(job);
+
+        infos[count++] = (job_info_t) {
+            .id = job->id,
+            .state = job->state,
+            .code = job->code,
+        };
+    }
+
+    return count;
+}
@@ -0,0 +1,57 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cli.h"
+
+// linux commands DOS started in the background with dsl -b. each gets a
+// small id DOS refers to it by, and its output goes to JOBS_DIR/<id>.log.
+// the VMM learns of exits through a pidfd in the event loop.
+//
+// jobs also start in JOBS_DIR, a ramdisk, rather than the DOS drive and
+// directory dsl was run from. DOS keeps running and accessing the disk while
+// a job does, and linux writing to the same FAT and ATA controller meanwhile,
+// directly or through the persistent overlay, corrupts them. for the same
+// reason there are no jobs at all when / itself is on the DOS drive
+#define JOBS_DIR DSL_RUN_DIR "/jobs"
+
+// jobs that can be running or waiting to be collected at once
+#define JOB_MAX 16
+
+#define JOB_RUNNING 0
+#define JOB_EXITED 1
+
+// what INT E7 AH=05h lists for each job
+typedef struct job_info {
+    uint16_t id;
+    uint16_t state;
+    // exit status, 128 + signal if killed
+    uint16_t code;
+}
+__attribute__((packed)) job_info_t;
+
+void
+jobs_init();
+
+// starts cmdline in JOBS_DIR through a spare shell, returning its id or 0
+// if it could not be started or / is on the DOS drive
+uint16_t
+jobs_start(const char* cmdline);
+
+// state of job id, with its exit status in code once exited. false if there
+// is no such job
+bool
+jobs_status(uint16_t id, uint16_t* state, uint16_t* code);
+
+// waits for job id, or any job if id is 0, to exit and forgets it. runs the
+// event loop meanwhile. false if there is no such job
+bool
+jobs_wait(uint16_t* id, uint16_t* code);
+
+// fills in up to max jobs, returning how many
+uint16_t
+jobs_list(job_info_t* infos, uint16_t max);
+
+#endif
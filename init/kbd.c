@@ -1,5 +1,4 @@
 #include <errno.h>
-#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +6,7 @@
 
 #include "kbd.h"
 #include "panic.h"
+#include "stats.h"
 #include "vm86.h"
 
 #define KBD_DATA_PORT       0x60
@@ -17,76 +17,162 @@
 
 static void process_key(kbd_t* kbd, uint8_t key);
 
+// Emulated 8042 keyboard controller. DOS never gets at the real one, Linux
+// owns it. Commands written to it are dropped.
+
+static uint8_t
+kbd_port_inb(void* dev, uint16_t port)
+{
+    kbd_t* kbd = dev;
+
+    if (port == KBD_STATUS_PORT) {
+        return (kbd_has_output(kbd) ? KBD_STATUS_HAS_DATA : 0) | KBD_STATUS_SYSTEM;
+    }
+
+    if (kbd_has_output(kbd)) {
+        kbd->last_output = kbd->output[kbd->output_head++ % KBD_OUTPUT_SIZE];
+    }
+
+    // reading with nothing buffered returns the previous byte again
+    return kbd->last_output;
+}
+
+static void
+kbd_port_outb(void* dev, uint16_t port, uint8_t value)
+{
+    (void)dev;
+    (void)port;
+    (void)value;
+}
+
+// rounds the requested key buffer depth up to a power of two
+static uint32_t
+buffer_size()
+{
+    const char* param = getenv("dsl_kbd_buffer");
+
+    if (param == NULL) {
+        return KBD_BUFFER_SIZE;
+    }
+
+    unsigned long requested = strtoul(param, NULL, 0);
+
+    if (requested == 0 || requested > KBD_BUFFER_MAX) {
+        printf("warn: bad dsl_kbd_buffer '%s', using %d\r\n", param, KBD_BUFFER_SIZE);
+        return KBD_BUFFER_SIZE;
+    }
+
+    uint32_t size = 1;
+
+    while (size < requested) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
 void
 kbd_init(kbd_t* kbd)
 {
-    memset(kbd->keybuff, 0, sizeof(kbd->keybuff));
-    kbd->keybuff_len = 0;
+    memset(kbd, 0, sizeof(*kbd));
+
+    uint32_t size = buffer_size();
+    kbd->keybuff = calloc(size, sizeof(kbd->keybuff[0]));
+    kbd->keybuff_mask = size - 1;
+
+    if (!kbd->keybuff) {
+        fatal("alloc key buffer");
+    }
+
+    kbd->device = (port_device_t) {
+        .name = "8042",
+        .kind = PORT_EMULATE,
+        .dev = kbd,
+        .inb = kbd_port_inb,
+        .outb = kbd_port_outb,
+    };
+
+    port_register(KBD_DATA_PORT, KBD_DATA_PORT, &kbd->device);
+    port_register(KBD_STATUS_PORT, KBD_STATUS_PORT, &kbd->device);
+}
+
+bool
+kbd_has_output(kbd_t* kbd)
+{
+    return kbd->output_tail != kbd->output_head;
+}
+
+void
+kbd_discard_output(kbd_t* kbd)
+{
+    if (kbd_has_output(kbd)) {
+        kbd->last_output = kbd->output[(kbd->output_tail - 1) % KBD_OUTPUT_SIZE];
+        kbd->output_head = kbd->output_tail;
+    }
 }
 
 void
 kbd_send_input(kbd_t* kbd, uint8_t scancode)
 {
+    if (kbd->output_tail - kbd->output_head < KBD_OUTPUT_SIZE) {
+        kbd->output[kbd->output_tail++ % KBD_OUTPUT_SIZE] = scancode;
+    } else {
+        stats->kbd_output_overflows++;
+    }
+
     process_key(kbd, scancode);
 }
 
+void
+kbd_send_input_bulk(kbd_t* kbd, const uint8_t* scancodes, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        kbd_send_input(kbd, scancodes[i]);
+    }
+}
+
 // Glue code for BIOS keyboard services:
 
 static uint8_t
 enqueue_key(kbd_t* kbd, uint16_t keycode)
 {
-    if (kbd->keybuff_len == KBD_BUFFER_SIZE) {
+    if (kbd->keybuff_tail - kbd->keybuff_head > kbd->keybuff_mask) {
         // buffer full, drop input
+        stats->kbd_dropped_keys++;
         return 0;
     }
 
-    kbd->keybuff[kbd->keybuff_len++] = keycode;
+    kbd->keybuff[kbd->keybuff_tail++ & kbd->keybuff_mask] = keycode;
     return 1;
 }
 
-static void
-wait_for_key(kbd_t* kbd)
+uint32_t
+kbd_free_space(kbd_t* kbd)
 {
-    // wait for stdin to become ready
-    while (1) {
-        struct pollfd fds = { .fd = 0, .events = POLLIN, .revents = 0 };
-        int rc = poll(&fds, 1, -1);
-
-        if (rc < 0) {
-            if (errno == EAGAIN) {
-                continue;
-            }
+    return kbd->keybuff_mask + 1 - (kbd->keybuff_tail - kbd->keybuff_head);
+}
 
-            perror("kbd poll");
-            return;
-        }
+size_t
+kbd_inject(kbd_t* kbd, const uint16_t* keycodes, size_t count)
+{
+    size_t space = kbd_free_space(kbd);
 
-        if (rc > 0) {
-            break;
-        }
+    if (count > space) {
+        count = space;
     }
 
-    // read from stdin
-    while (1) {
-        char scan;
-        ssize_t rc = read(0, &scan, 1);
-
-        if (rc < 0) {
-            if (errno == EAGAIN) {
-                continue;
-            }
-
-            perror("kbd read");
-            return;
-        }
+    for (size_t i = 0; i < count; i++) {
+        kbd->keybuff[kbd->keybuff_tail++ & kbd->keybuff_mask] = keycodes[i];
+    }
 
-        if (rc == 0) {
-            // eof?
-            return;
-        }
+    return count;
+}
 
-        kbd_send_input(kbd, scan);
-    }
+void
+kbd_notify_space(kbd_t* kbd, void (*fn)(void* ctx), void* ctx)
+{
+    kbd->space_fn = fn;
+    kbd->space_ctx = ctx;
 }
 
 static void
@@ -142,23 +228,21 @@ static struct {
 #define GET_GLOBAL(x) x
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
-static void
+// returns false if a key needs to be waited for, in which case the caller
+// should idle until there is input and then retry
+static bool
 dequeue_key(kbd_t* kbd, regs_t* regs, int incr, int extended)
 {
-    for (;;) {
-        if (kbd->keybuff_len > 0) {
-            break;
-        }
-
+    if (kbd->keybuff_tail == kbd->keybuff_head) {
         if (!incr) {
             regs->eflags.word.lo |= FLAG_ZERO;
-            return;
+            return true;
         }
 
-        wait_for_key(kbd);
+        return false;
     }
 
-    uint16_t keycode = kbd->keybuff[0];
+    uint16_t keycode = kbd->keybuff[kbd->keybuff_head & kbd->keybuff_mask];
     uint8_t ascii = keycode & 0xff;
 
     if (!extended) {
@@ -182,11 +266,18 @@ dequeue_key(kbd_t* kbd, regs_t* regs, int incr, int extended)
 
     if (!incr) {
         regs->eflags.word.lo &= ~FLAG_ZERO;
-        return;
+        return true;
     }
 
-    kbd->keybuff_len--;
-    memmove(kbd->keybuff, &kbd->keybuff[1], kbd->keybuff_len * sizeof(kbd->keybuff[0]));
+    kbd->keybuff_head++;
+
+    if (kbd->space_fn && kbd_free_space(kbd) > kbd->keybuff_mask / 2) {
+        void (*fn)(void*) = kbd->space_fn;
+        kbd->space_fn = NULL;
+        fn(kbd->space_ctx);
+    }
+
+    return true;
 }
 
 
@@ -261,10 +352,10 @@ kbd_prtscr(int key_release)
 }
 
 // read keyboard input
-static void
+static bool
 handle_1600(kbd_t* kbd, regs_t* regs)
 {
-    dequeue_key(kbd, regs, 1, 0);
+    return dequeue_key(kbd, regs, 1, 0);
 }
 
 // check keyboard status
@@ -326,10 +417,10 @@ handle_160a(kbd_t* kbd, regs_t* regs)
 }
 
 // read MF-II keyboard input
-static void
+static bool
 handle_1610(kbd_t* kbd, regs_t* regs)
 {
-    dequeue_key(kbd, regs, 1, 1);
+    return dequeue_key(kbd, regs, 1, 1);
 }
 
 // check MF-II keyboard status
@@ -407,20 +498,20 @@ set_leds(void)
 }
 
 // INT 16h Keyboard Service Entry Point
-void
+bool
 kbd_int(kbd_t* kbd, regs_t* regs)
 {
     // XXX - set_leds should be called from irq handler
     set_leds();
 
     switch (regs->eax.byte.hi) {
-    case 0x00: handle_1600(kbd, regs); break;
+    case 0x00: return handle_1600(kbd, regs);
     case 0x01: handle_1601(kbd, regs); break;
     case 0x02: handle_1602(kbd, regs); break;
     case 0x05: handle_1605(kbd, regs); break;
     case 0x09: handle_1609(kbd, regs); break;
     case 0x0a: handle_160a(kbd, regs); break;
-    case 0x10: handle_1610(kbd, regs); break;
+    case 0x10: return handle_1610(kbd, regs);
     case 0x11: handle_1611(kbd, regs); break;
     case 0x12: handle_1612(kbd, regs); break;
     case 0x92: handle_1692(kbd, regs); break;
@@ -428,6 +519,8 @@ kbd_int(kbd_t* kbd, regs_t* regs)
     case 0x6f: handle_166f(kbd, regs); break;
     default:   handle_16XX(kbd, regs); break;
     }
+
+    return true;
 }
 
 #define none 0
@@ -535,6 +628,30 @@ struct scaninfo key_ext_slash = {
     0xe02f, 0xe02f, 0x9500, 0xa400
 };
 
+uint16_t
+kbd_ascii_keycode(uint8_t ascii)
+{
+    if (ascii == 0) {
+        return 0;
+    }
+
+    // prefer unshifted keys, then shifted, then control characters
+    for (int column = 0; column < 3; column++) {
+        for (size_t i = 0; i < ARRAY_SIZE(scan_to_keycode); i++) {
+            struct scaninfo* info = &scan_to_keycode[i];
+            u16 keycode = column == 0 ? info->normal
+                : column == 1 ? info->shift
+                : info->control;
+
+            if ((keycode & 0xff) == ascii) {
+                return keycode;
+            }
+        }
+    }
+
+    return 0;
+}
+
 // Handle a ps2 style scancode read from the keyboard.
 static void
 __process_key(kbd_t* kbd, uint8_t scancode)
@@ -1,28 +1,89 @@
 #ifndef KBD_H
 #define KBD_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "port.h"
 #include "vm86.h"
 
 #define KBD_IRQ 1
-#define KBD_BUFFER_SIZE 16
 #define KBD_PORT_LO 0x60
 #define KBD_PORT_HI 0x64
 
+// default and maximum depth of the BIOS key buffer, the dsl_kbd_buffer=
+// kernel parameter picks anything in between. always a power of two
+#define KBD_BUFFER_SIZE 64
+#define KBD_BUFFER_MAX 4096
+
+// must be a power of two
+#define KBD_OUTPUT_SIZE 16
+
 typedef struct kbd {
-    uint16_t keybuff[KBD_BUFFER_SIZE];
-    size_t keybuff_len;
+    // ring of BIOS keycodes for INT 16h. head and tail run freely and are
+    // masked on access, so tail - head is the number of keys buffered
+    uint16_t* keybuff;
+    uint32_t keybuff_mask;
+    uint32_t keybuff_head;
+    uint32_t keybuff_tail;
+
+    // raw scancodes waiting to be read from the emulated 8042 data port by
+    // DOS programs that hook IRQ 1, a ring like keybuff
+    uint8_t output[KBD_OUTPUT_SIZE];
+    uint32_t output_head;
+    uint32_t output_tail;
+    uint8_t last_output;
+    port_device_t device;
+
+    // called once when DOS has drained the key buffer to half full, see
+    // kbd_notify_space
+    void (*space_fn)(void* ctx);
+    void* space_ctx;
 }
 kbd_t;
 
+// also registers the emulated 8042 ports
 void
 kbd_init(kbd_t* kbd);
 
+// true if the 8042 output buffer is full, which is what raises IRQ 1
+bool
+kbd_has_output(kbd_t* kbd);
+
+// drops the 8042 output buffer when nothing hooks IRQ 1 to read it, so a
+// program that hooks it later does not get stale scancodes. the data port
+// keeps returning the newest one for programs that poll it
+void
+kbd_discard_output(kbd_t* kbd);
+
 void
 kbd_send_input(kbd_t* kbd, uint8_t scancode);
 
+// feeds a batch of scancodes read from the console
 void
+kbd_send_input_bulk(kbd_t* kbd, const uint8_t* scancodes, size_t len);
+
+// free slots in the BIOS key buffer
+uint32_t
+kbd_free_space(kbd_t* kbd);
+
+// puts BIOS keycodes (scancode << 8 | ascii) straight into the key buffer,
+// bypassing scancode translation. returns how many fit
+size_t
+kbd_inject(kbd_t* kbd, const uint16_t* keycodes, size_t count);
+
+// arranges for fn to be called once the key buffer is at least half empty,
+// for producers that stop when it fills up
+void
+kbd_notify_space(kbd_t* kbd, void (*fn)(void* ctx), void* ctx);
+
+// BIOS keycode that types ascii on a US keyboard, or 0 if there is none
+uint16_t
+kbd_ascii_keycode(uint8_t ascii);
+
+// handles INT 16h. returns false if DOS asked to wait for a key and none is
+// buffered, the VMM should then idle and retry the call once there is input
+bool
 kbd_int(kbd_t* kbd, regs_t* regs);
 
 #endif
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "kbd.h"
+#include "keys.h"
+#include "panic.h"
+
+#define KEYS_MAX_CLIENTS 4
+
+// bytes read from a client per read() call
+#define KEYS_STAGING_SIZE 512
+
+typedef struct keys_client {
+    // -1 when the slot is free
+    int fd;
+    // taken out of the event loop while the key buffer is full
+    bool paused;
+    // odd byte left over from the last read, a keycode split across reads
+    bool has_carry;
+    uint8_t carry;
+}
+keys_client_t;
+
+static kbd_t* keys_kbd;
+static int listen_fd = -1;
+static keys_client_t clients[KEYS_MAX_CLIENTS];
+
+static void on_client(void* ctx, uint32_t events);
+
+static void
+close_client(keys_client_t* client)
+{
+    if (!client->paused) {
+        event_del(client->fd);
+    }
+
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void
+resume_clients(void* ctx)
+{
+    (void)ctx;
+
+    for (int i = 0; i < KEYS_MAX_CLIENTS; i++) {
+        keys_client_t* client = &clients[i];
+
+        if (client->fd >= 0 && client->paused) {
+            client->paused = false;
+            event_add(client->fd, EPOLLIN, on_client, client);
+        }
+    }
+}
+
+static void
+pause_client(keys_client_t* client)
+{
+    // removed from epoll outright rather than just dropping EPOLLIN, a hung
+    // up client would otherwise keep reporting EPOLLHUP while we wait
+    event_del(client->fd);
+    client->paused = true;
+
+    kbd_notify_space(keys_kbd, resume_clients, NULL);
+}
+
+// reads one batch of keycodes, returns false once the socket is drained, the
+// key buffer is full or the client has gone away
+static bool
+read_client(keys_client_t* client)
+{
+    uint32_t space = kbd_free_space(keys_kbd);
+
+    if (space == 0) {
+        pause_client(client);
+        return false;
+    }
+
+    uint8_t buf[KEYS_STAGING_SIZE];
+    size_t have = 0;
+
+    if (client->has_carry) {
+        buf[have++] = client->carry;
+    }
+
+    // never read more than fits in the key buffer, the rest waits in the
+    // socket and pushes back on the writer
+    size_t want = space * 2 - have;
+
+    if (want > sizeof(buf) - have) {
+        want = sizeof(buf) - have;
+    }
+
+    ssize_t nread = read(client->fd, buf + have, want);
+
+    if (nread < 0 && errno == EINTR) {
+        return true;
+    }
+
+    if (nread < 0 && errno == EAGAIN) {
+        return false;
+    }
+
+    if (nread <= 0) {
+        close_client(client);
+        return false;
+    }
+
+    have += nread;
+
+    uint16_t keycodes[KEYS_STAGING_SIZE / 2];
+    size_t count = have / 2;
+
+    for (size_t i = 0; i < count; i++) {
+        keycodes[i] = buf[i * 2] | buf[i * 2 + 1] << 8;
+    }
+
+    kbd_inject(keys_kbd, keycodes, count);
+
+    client->has_carry = have % 2;
+    client->carry = buf[have - 1];
+
+    return true;
+}
+
+static void
+on_client(void* ctx, uint32_t events)
+{
+    (void)events;
+
+    while (read_client(ctx)) {
+    }
+}
+
+static void
+on_accept(void* ctx, uint32_t events)
+{
+    (void)ctx;
+    (void)events;
+
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd < 0) {
+        return;
+    }
+
+    for (int i = 0; i < KEYS_MAX_CLIENTS; i++) {
+        keys_client_t* client = &clients[i];
+
+        if (client->fd < 0) {
+            *client = (keys_client_t) { .fd = fd };
+            event_add(fd, EPOLLIN, on_client, client);
+            return;
+        }
+    }
+
+    printf("warn: too many keystroke clients\r\n");
+    close(fd);
+}
+
+void
+keys_init(kbd_t* kbd)
+{
+    keys_kbd = kbd;
+
+    for (int i = 0; i < KEYS_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listen_fd < 0) {
+        fatal("keys socket");
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, KEYS_SOCKET_PATH);
+    unlink(KEYS_SOCKET_PATH);
+
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        fatal("bind " KEYS_SOCKET_PATH);
+    }
+
+    if (listen(listen_fd, KEYS_MAX_CLIENTS)) {
+        fatal("listen " KEYS_SOCKET_PATH);
+    }
+
+    event_add(listen_fd, EPOLLIN, on_accept, NULL);
+}
@@ -0,0 +1,17 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+#include "cli.h"
+#include "kbd.h"
+
+// stream socket that linux programs write little endian 16 bit BIOS keycodes
+// (scancode << 8 | ascii) to, which go straight into the DOS key buffer. when
+// the buffer fills up the VMM stops reading until DOS catches up, so writers
+// block instead of losing keys
+#define KEYS_SOCKET_PATH DSL_RUN_DIR "/keys.sock"
+
+// creates the socket and adds it to the event loop
+void
+keys_init(kbd_t* kbd);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdint.h>
+
+#include "vm86.h"
+
+// DOS memory is identity mapped into the supervisor, see run_vmm. host
+// builds (DSL_HOST, see test/) point it at an arena the harness allocates
+#ifdef DSL_HOST
+extern uint8_t* guest_mem;
+#define GUEST_BASE ((uintptr_t)guest_mem)
+#else
+#define GUEST_BASE 0
+#endif
+
+static inline void*
+linear(uint16_t segment, uint16_t offset)
+{
+    uint32_t seg32 = segment;
+    uint32_t off32 = offset;
+    uint32_t lin = (seg32 << 4) + off32;
+    return (void*)(GUEST_BASE + lin);
+}
+
+static inline uint8_t
+peek8(uint16_t segment, uint16_t offset)
+{
+    return *(uint8_t*)linear(segment, offset);
+}
+
+static inline uint16_t
+peek16(uint16_t segment, uint16_t offset)
+{
+    return *(uint16_t*)linear(segment, offset);
+}
+
+static inline void
+poke16(uint16_t segment, uint16_t offset, uint16_t value)
+{
+    *(uint16_t*)linear(segment, offset) = value;
+}
+
+static inline uint8_t
+peekip(regs_t* regs, uint16_t offset)
+{
+    return peek8(regs->cs.word.lo, regs->eip.word.lo + offset);
+}
+
+#endif
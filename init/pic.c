@@ -0,0 +1,229 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pic.h"
+#include "port.h"
+
+// returns the highest priority IRQ on a chip that should be delivered, or -1
+// if none. priority is fixed with IR0 highest, and anything in service blocks
+// itself and everything below it
+static int
+chip_pending(pic_chip_t* chip, uint8_t extra_irr)
+{
+    uint8_t requested = (chip->irr | extra_irr) & ~chip->imr;
+
+    for (int irq = 0; irq < 8; irq++) {
+        uint8_t bit = 1 << irq;
+
+        if (chip->isr & bit) {
+            return -1;
+        }
+
+        if (requested & bit) {
+            return irq;
+        }
+    }
+
+    return -1;
+}
+
+// the slave's INT output is wired to the master's cascade input
+static uint8_t
+cascade_irr(pic_t* pic)
+{
+    if (pic->master.single) {
+        return 0;
+    }
+
+    return chip_pending(&pic->slave, 0) >= 0 ? 1 << PIC_CASCADE_IRQ : 0;
+}
+
+static void
+chip_eoi(pic_chip_t* chip, uint8_t ocw2)
+{
+    switch (ocw2 >> 5) {
+        case 1: // non-specific EOI
+        case 5: // rotate on non-specific EOI, rotation not supported
+            for (int irq = 0; irq < 8; irq++) {
+                if (chip->isr & (1 << irq)) {
+                    chip->isr &= ~(1 << irq);
+                    break;
+                }
+            }
+            break;
+        case 3: // specific EOI
+        case 7: // rotate on specific EOI
+            chip->isr &= ~(1 << (ocw2 & 7));
+            break;
+        default:
+            // rotation and priority commands, not supported
+            break;
+    }
+}
+
+static void
+chip_write_command(pic_chip_t* chip, uint8_t value)
+{
+    if (value & 0x10) {
+        // ICW1, starts initialization
+        chip->irr = 0;
+        chip->isr = 0;
+        chip->imr = 0;
+        chip->read_isr = false;
+        chip->auto_eoi = false;
+        chip->icw4_needed = value & 0x01;
+        chip->single = value & 0x02;
+        chip->icw_step = 2;
+        return;
+    }
+
+    if (value & 0x08) {
+        // OCW3, only register read selection is supported
+        if (value & 0x02) {
+            chip->read_isr = value & 0x01;
+        }
+        return;
+    }
+
+    // OCW2
+    chip_eoi(chip, value);
+}
+
+static void
+chip_write_data(pic_chip_t* chip, uint8_t value)
+{
+    switch (chip->icw_step) {
+        case 2:
+            chip->vector_base = value & 0xf8;
+            chip->icw_step = chip->single ? (chip->icw4_needed ? 4 : 0) : 3;
+            return;
+        case 3:
+            // cascade wiring is fixed
+            chip->icw_step = chip->icw4_needed ? 4 : 0;
+            return;
+        case 4:
+            chip->auto_eoi = value & 0x02;
+            chip->icw_step = 0;
+            return;
+        default:
+            // OCW1
+            chip->imr = value;
+            return;
+    }
+}
+
+static pic_chip_t*
+port_chip(pic_t* pic, uint16_t port)
+{
+    return (port & ~1) == PIC_SLAVE_PORT ? &pic->slave : &pic->master;
+}
+
+static uint8_t
+pic_inb(void* dev, uint16_t port)
+{
+    pic_chip_t* chip = port_chip(dev, port);
+
+    if (port & 1) {
+        return chip->imr;
+    }
+
+    return chip->read_isr ? chip->isr : chip->irr;
+}
+
+static void
+pic_outb(void* dev, uint16_t port, uint8_t value)
+{
+    pic_chip_t* chip = port_chip(dev, port);
+
+    if (port & 1) {
+        chip_write_data(chip, value);
+    } else {
+        chip_write_command(chip, value);
+    }
+}
+
+void
+pic_init(pic_t* pic)
+{
+    memset(pic, 0, sizeof(*pic));
+
+    // standard PC vectors, with the timer, keyboard and cascade unmasked
+    pic->master.vector_base = 0x08;
+    pic->master.imr = 0xf8;
+    pic->slave.vector_base = 0x70;
+    pic->slave.imr = 0xff;
+
+    pic->device = (port_device_t) {
+        .name = "pic",
+        .kind = PORT_EMULATE,
+        .dev = pic,
+        .inb = pic_inb,
+        .outb = pic_outb,
+    };
+
+    port_register(PIC_MASTER_PORT, PIC_MASTER_PORT + 1, &pic->device);
+    port_register(PIC_SLAVE_PORT, PIC_SLAVE_PORT + 1, &pic->device);
+}
+
+void
+pic_raise_irq(pic_t* pic, uint8_t irq)
+{
+    if (irq < 8) {
+        pic->master.irr |= 1 << irq;
+    } else {
+        pic->slave.irr |= 1 << (irq - 8);
+    }
+}
+
+bool
+pic_irq_busy(pic_t* pic, uint8_t irq)
+{
+    pic_chip_t* chip = irq < 8 ? &pic->master : &pic->slave;
+    uint8_t bit = 1 << (irq & 7);
+
+    return (chip->irr | chip->isr) & bit;
+}
+
+bool
+pic_has_pending(pic_t* pic)
+{
+    return chip_pending(&pic->master, cascade_irr(pic)) >= 0;
+}
+
+static uint8_t
+chip_acknowledge(pic_chip_t* chip, int irq)
+{
+    chip->irr &= ~(1 << irq);
+
+    if (!chip->auto_eoi) {
+        chip->isr |= 1 << irq;
+    }
+
+    return chip->vector_base + irq;
+}
+
+uint8_t
+pic_acknowledge(pic_t* pic)
+{
+    int irq = chip_pending(&pic->master, cascade_irr(pic));
+
+    if (irq == PIC_CASCADE_IRQ && !(pic->master.irr & (1 << irq)) && cascade_irr(pic)) {
+        // the request came from the slave
+        int slave_irq = chip_pending(&pic->slave, 0);
+        chip_acknowledge(&pic->master, irq);
+        return chip_acknowledge(&pic->slave, slave_irq);
+    }
+
+    return chip_acknowledge(&pic->master, irq);
+}
+
+uint8_t
+pic_irq_vector(pic_t* pic, uint8_t irq)
+{
+    if (irq < 8) {
+        return pic->master.vector_base + irq;
+    } else {
+        return pic->slave.vector_base + irq - 8;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "port.h"
+
+#define PIC_MASTER_PORT 0x20
+#define PIC_SLAVE_PORT  0xa0
+
+// the slave is cascaded into this master IRQ line
+#define PIC_CASCADE_IRQ 2
+
+typedef struct pic_chip {
+    uint8_t irr;
+    uint8_t isr;
+    uint8_t imr;
+    uint8_t vector_base;
+
+    // index of the next initialization command word expected on the data
+    // port, or 0 when not initializing
+    uint8_t icw_step;
+    bool icw4_needed;
+    bool single;
+    bool auto_eoi;
+
+    // selects ISR rather than IRR for reads from the command port (OCW3)
+    bool read_isr;
+}
+pic_chip_t;
+
+// a virtual 8259 pair owned by the VMM. DOS programs it through the usual
+// ports, and the VMM raises IRQs on it and delivers the resulting vectors
+typedef struct pic {
+    pic_chip_t master;
+    pic_chip_t slave;
+    port_device_t device;
+}
+pic_t;
+
+// resets both chips to the state the BIOS leaves them in and registers the
+// PIC ports
+void
+pic_init(pic_t* pic);
+
+// raises an edge on IRQ line 0-15
+void
+pic_raise_irq(pic_t* pic, uint8_t irq);
+
+// true if an IRQ has been raised and not yet finished with by an EOI, so
+// raising it again now would be lost
+bool
+pic_irq_busy(pic_t* pic, uint8_t irq);
+
+// true if there is an unmasked IRQ of higher priority than anything in service
+bool
+pic_has_pending(pic_t* pic);
+
+// acknowledges the highest priority pending IRQ and returns its vector, call
+// only when pic_has_pending is true
+uint8_t
+pic_acknowledge(pic_t* pic);
+
+// vector that an IRQ line is currently mapped to
+uint8_t
+pic_irq_vector(pic_t* pic, uint8_t irq);
+
+#endif
@@ -0,0 +1,388 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "hw.h"
+#include "panic.h"
+#include "pic.h"
+#include "pit.h"
+#include "port.h"
+#include "stats.h"
+
+#define PIT_PORT_BASE 0x40
+#define PIT_SPEAKER_PORT 0x42
+#define PIT_COMMAND_PORT 0x43
+#define PIT_CONTROL_PORT 0x61
+
+#define CONTROL_GATE2 0x01
+#define CONTROL_SPEAKER 0x02
+#define CONTROL_REFRESH 0x10
+#define CONTROL_OUT2 0x20
+
+// ticks that may build up while DOS has interrupts off before we start
+// dropping them, a little over a second at the default rate
+#define MAX_PENDING_TICKS 20
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t
+reload_ticks(pit_channel_t* channel)
+{
+    return channel->reload ? channel->reload : 0x10000;
+}
+
+static uint64_t
+elapsed_ticks(pit_channel_t* channel)
+{
+    uint64_t ns = now_ns() - channel->start_ns;
+
+    // split up, as ns * PIT_FREQ overflows after a few hours
+    return ns / 1000000000 * PIT_FREQ + ns % 1000000000 * PIT_FREQ / 1000000000;
+}
+
+static uint16_t
+current_count(pit_channel_t* channel)
+{
+    uint32_t reload = reload_ticks(channel);
+    uint64_t elapsed = elapsed_ticks(channel);
+
+    switch (channel->mode) {
+        case 0:
+            // counts down once, then keeps wrapping through 0xffff
+            if (elapsed < reload) {
+                return reload - elapsed;
+            }
+
+            return 0x10000 - (elapsed - reload) % 0x10000;
+        case 3: {
+            // square wave counts down by two, twice per period
+            uint32_t e = elapsed % reload;
+            return 2 * e < reload ? reload - 2 * e : 2 * reload - 2 * e;
+        }
+        default:
+            return reload - elapsed % reload;
+    }
+}
+
+static bool
+output(pit_channel_t* channel)
+{
+    uint32_t reload = reload_ticks(channel);
+    uint64_t elapsed = elapsed_ticks(channel);
+
+    switch (channel->mode) {
+        case 0:
+            return elapsed >= reload;
+        case 3:
+            return elapsed % reload < reload / 2;
+        default:
+            return elapsed % reload != reload - 1;
+    }
+}
+
+// programs the timerfd from channel 0
+static void
+arm_timer(pit_t* pit)
+{
+    pit_channel_t* channel = &pit->channels[0];
+    uint64_t period_ns = (uint64_t)reload_ticks(channel) * 1000000000 / PIT_FREQ;
+
+    struct itimerspec spec = { 0 };
+    spec.it_value.tv_sec = period_ns / 1000000000;
+    spec.it_value.tv_nsec = period_ns % 1000000000;
+
+    // mode 0 interrupts once on terminal count, the others are periodic
+    if (channel->mode != 0) {
+        spec.it_interval = spec.it_value;
+    }
+
+    if (timerfd_settime(pit->timerfd, 0, &spec, NULL)) {
+        fatal("timerfd_settime");
+    }
+}
+
+static void
+load_count(pit_t* pit, int index)
+{
+    pit->channels[index].start_ns = now_ns();
+
+    if (index == 0) {
+        arm_timer(pit);
+    }
+}
+
+static void
+write_command(pit_t* pit, uint8_t value)
+{
+    int index = value >> 6;
+
+    if (index == 3) {
+        // read back command, latches any selected channels
+        for (int i = 0; i < 3; i++) {
+            if (!(value & (2 << i))) {
+                continue;
+            }
+
+            pit_channel_t* channel = &pit->channels[i];
+
+            if (!(value & 0x20) && !channel->count_latched) {
+                channel->count_latched = true;
+                channel->latch = current_count(channel);
+            }
+
+            if (!(value & 0x10) && !channel->status_latched) {
+                channel->status_latched = true;
+                channel->status = (output(channel) ? 0x80 : 0)
+                    | channel->access << 4 | channel->mode << 1;
+            }
+        }
+
+        return;
+    }
+
+    pit_channel_t* channel = &pit->channels[index];
+    uint8_t access = (value >> 4) & 3;
+
+    if (access == 0) {
+        // counter latch command
+        if (!channel->count_latched) {
+            channel->count_latched = true;
+            channel->latch = current_count(channel);
+        }
+
+        return;
+    }
+
+    channel->access = access;
+    channel->mode = (value >> 1) & 7;
+    channel->write_hi = false;
+    channel->read_hi = false;
+
+    // modes 6 and 7 are aliases of 2 and 3
+    if (channel->mode > 5) {
+        channel->mode -= 4;
+    }
+}
+
+static void
+write_count(pit_t* pit, int index, uint8_t value)
+{
+    pit_channel_t* channel = &pit->channels[index];
+
+    switch (channel->access) {
+        case 1:
+            channel->reload = value;
+            break;
+        case 2:
+            channel->reload = value << 8;
+            break;
+        default:
+            if (!channel->write_hi) {
+                channel->reload = (channel->reload & 0xff00) | value;
+                channel->write_hi = true;
+                return;
+            }
+
+            channel->reload = (channel->reload & 0x00ff) | value << 8;
+            channel->write_hi = false;
+            break;
+    }
+
+    load_count(pit, index);
+}
+
+static uint8_t
+read_count(pit_channel_t* channel)
+{
+    if (channel->status_latched) {
+        channel->status_latched = false;
+        return channel->status;
+    }
+
+    uint16_t count = channel->count_latched ? channel->latch : current_count(channel);
+    uint8_t value;
+
+    switch (channel->access) {
+        case 1:
+            value = count;
+            channel->count_latched = false;
+            break;
+        case 2:
+            value = count >> 8;
+            channel->count_latched = false;
+            break;
+        default:
+            value = channel->read_hi ? count >> 8 : count;
+
+            if (channel->read_hi) {
+                channel->count_latched = false;
+            }
+
+            channel->read_hi = !channel->read_hi;
+            break;
+    }
+
+    return value;
+}
+
+static uint8_t
+pit_inb(void* dev, uint16_t port)
+{
+    pit_t* pit = dev;
+
+    if (port == PIT_COMMAND_PORT) {
+        // write only
+        return 0xff;
+    }
+
+    return read_count(&pit->channels[port - PIT_PORT_BASE]);
+}
+
+static void
+pit_outb(void* dev, uint16_t port, uint8_t value)
+{
+    pit_t* pit = dev;
+
+    // channel 2 also drives the real speaker, so programming of it is
+    // passed on as well as emulated
+    if (port == PIT_COMMAND_PORT) {
+        write_command(pit, value);
+
+        if (value >> 6 == 2) {
+            outb(value, PIT_COMMAND_PORT);
+        }
+    } else {
+        write_count(pit, port - PIT_PORT_BASE, value);
+
+        if (port == PIT_SPEAKER_PORT) {
+            outb(value, PIT_SPEAKER_PORT);
+        }
+    }
+}
+
+static uint8_t
+control_inb(void* dev, uint16_t port)
+{
+    pit_t* pit = dev;
+    (void)port;
+
+    // the refresh bit toggles constantly on real hardware and is used for
+    // short delays, flipping it on every read is close enough
+    pit->refresh = !pit->refresh;
+
+    uint8_t value = pit->control;
+
+    if (pit->refresh) {
+        value |= CONTROL_REFRESH;
+    }
+
+    if ((pit->control & CONTROL_GATE2) && output(&pit->channels[2])) {
+        value |= CONTROL_OUT2;
+    }
+
+    return value;
+}
+
+static void
+control_outb(void* dev, uint16_t port, uint8_t value)
+{
+    pit_t* pit = dev;
+    (void)port;
+
+    uint8_t gate = value & CONTROL_GATE2;
+
+    // a rising edge on the gate restarts channel 2
+    if (gate && !(pit->control & CONTROL_GATE2)) {
+        load_count(pit, 2);
+    }
+
+    pit->control = value & (CONTROL_GATE2 | CONTROL_SPEAKER);
+
+    // and the gate and speaker bits go to the real port 0x61 so the speaker
+    // sounds, leaving linux's other bits in it alone
+    uint8_t real = inb(PIT_CONTROL_PORT) & 0x0f & ~(CONTROL_GATE2 | CONTROL_SPEAKER);
+    outb(real | pit->control, PIT_CONTROL_PORT);
+}
+
+// collects timerfd expirations, run from the event loop
+static void
+on_timer(void* ctx, uint32_t events)
+{
+    pit_t* pit = ctx;
+    uint64_t expirations;
+    (void)events;
+
+    stats_tick();
+
+    if (read(pit->timerfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        pit->pending_ticks += expirations;
+
+        if (pit->pending_ticks > MAX_PENDING_TICKS) {
+            pit->pending_ticks = MAX_PENDING_TICKS;
+        }
+    }
+}
+
+void
+pit_init(pit_t* pit)
+{
+    memset(pit, 0, sizeof(*pit));
+
+    pit->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (pit->timerfd < 0) {
+        fatal("timerfd_create");
+    }
+
+    // BIOS default: channel 0 in square wave mode at 18.2 Hz, channel 2
+    // ready for the speaker
+    for (int i = 0; i < 3; i++) {
+        pit->channels[i].access = 3;
+        pit->channels[i].mode = 3;
+        pit->channels[i].start_ns = now_ns();
+    }
+
+    arm_timer(pit);
+
+    pit->device = (port_device_t) {
+        .name = "pit",
+        .kind = PORT_EMULATE,
+        .dev = pit,
+        .inb = pit_inb,
+        .outb = pit_outb,
+    };
+
+    pit->control_device = (port_device_t) {
+        .name = "system control",
+        .kind = PORT_EMULATE,
+        .dev = pit,
+        .inb = control_inb,
+        .outb = control_outb,
+    };
+
+    port_register(PIT_PORT_BASE, PIT_COMMAND_PORT, &pit->device);
+    port_register(PIT_CONTROL_PORT, PIT_CONTROL_PORT, &pit->control_device);
+
+    event_add(pit->timerfd, EPOLLIN, on_timer, pit);
+}
+
+void
+pit_raise_irqs(pit_t* pit, pic_t* pic)
+{
+    if (pit->pending_ticks && !pic_irq_busy(pic, PIT_IRQ)) {
+        pit->pending_ticks--;
+        pic_raise_irq(pic, PIT_IRQ);
+    }
+}
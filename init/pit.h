@@ -0,0 +1,62 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pic.h"
+#include "port.h"
+
+#define PIT_IRQ 0
+#define PIT_FREQ 1193182
+
+typedef struct pit_channel {
+    // reload value, 0 counts as 65536
+    uint16_t reload;
+    uint8_t mode;
+    // 1 = lobyte only, 2 = hibyte only, 3 = lobyte then hibyte
+    uint8_t access;
+    bool write_hi;
+    bool read_hi;
+
+    bool count_latched;
+    uint16_t latch;
+    bool status_latched;
+    uint8_t status;
+
+    // CLOCK_MONOTONIC time the current count was loaded at
+    uint64_t start_ns;
+}
+pit_channel_t;
+
+// an emulated 8254. channel 0 is backed by a timerfd and raises IRQ 0 on the
+// virtual PIC, channel 2 and the port 0x61 speaker gate are emulated well
+// enough for delay loops. writes to them are also passed through to the real
+// ones so the PC speaker works. channel 1 (DRAM refresh) is not emulated.
+typedef struct pit {
+    pit_channel_t channels[3];
+    int timerfd;
+
+    // timer interrupts that have expired but not been raised yet
+    uint32_t pending_ticks;
+
+    // gate and speaker enable bits of port 0x61
+    uint8_t control;
+    bool refresh;
+
+    port_device_t device;
+    port_device_t control_device;
+}
+pit_t;
+
+// programs channel 0 the way the BIOS does, registers the PIT ports and adds
+// the timerfd to the event loop
+void
+pit_init(pit_t* pit);
+
+// raises IRQ 0 for the next expired channel 0 period if the PIC is ready for
+// it
+void
+pit_raise_irqs(pit_t* pit, pic_t* pic);
+
+#endif
@@ -0,0 +1,334 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hw.h"
+#include "port.h"
+#include "stats.h"
+#include "trace.h"
+
+// controls how passthrough ports are exposed to DOS. selected with the
+// dsl_ports= kernel parameter, which can be passed as an argument to dsl.com
+// when starting DSL
+enum port_mode {
+    // every port access traps and is dispatched by the supervisor
+    PORTS_TRAP,
+    // passthrough ports are granted in the TSS I/O bitmap up front, so DOS
+    // accesses them natively without exiting vm86 mode at all
+    PORTS_PASSTHROUGH,
+    // passthrough ports start out trapped and are granted once they have
+    // trapped PORT_PROMOTE_THRESHOLD times
+    PORTS_ADAPTIVE,
+};
+
+#define PORT_PROMOTE_THRESHOLD 64
+
+static enum port_mode port_mode = PORTS_PASSTHROUGH;
+
+// owning device of every port, never NULL once port_init has run
+static port_device_t* port_table[0x10000];
+
+// number of trapped accesses per port, of any width
+static uint32_t port_trap_count[0x10000];
+
+port_device_t port_passthrough = {
+    .name = "passthrough",
+    .kind = PORT_PASSTHROUGH,
+};
+
+port_device_t port_ignore = {
+    .name = "ignore",
+    .kind = PORT_IGNORE,
+};
+
+port_device_t port_log = {
+    .name = "log",
+    .kind = PORT_LOG,
+};
+
+void
+port_init()
+{
+    for (uint32_t port = 0; port < 0x10000; port++) {
+        port_table[port] = &port_log;
+    }
+
+    const char* mode = getenv("dsl_ports");
+
+    if (mode == NULL || strcmp(mode, "passthrough") == 0) {
+        port_mode = PORTS_PASSTHROUGH;
+    } else if (strcmp(mode, "adaptive") == 0) {
+        port_mode = PORTS_ADAPTIVE;
+    } else if (strcmp(mode, "trap") == 0) {
+        port_mode = PORTS_TRAP;
+    } else {
+        printf("warn: unknown dsl_ports mode '%s', using passthrough\r\n", mode);
+        port_mode = PORTS_PASSTHROUGH;
+    }
+}
+
+void
+port_register(uint16_t first, uint16_t last, port_device_t* device)
+{
+    for (uint32_t port = first; port <= last; port++) {
+        port_table[port] = device;
+    }
+}
+
+static bool
+is_passthrough(uint16_t port)
+{
+    return port_table[port]->kind == PORT_PASSTHROUGH;
+}
+
+void
+port_grant()
+{
+    if (port_mode != PORTS_PASSTHROUGH) {
+        return;
+    }
+
+    uint32_t port = 0;
+
+    while (port < 0x10000) {
+        if (!is_passthrough(port)) {
+            port++;
+            continue;
+        }
+
+        // grant contiguous runs of ports with a single ioperm call
+        uint32_t first = port;
+
+        while (port < 0x10000 && is_passthrough(port)) {
+            port++;
+        }
+
+        if (ioperm(first, port - first, 1)) {
+            perror("warn: ioperm");
+        }
+    }
+}
+
+static void
+port_trapped(uint16_t port, uint16_t width)
+{
+    uint32_t count = ++port_trap_count[port];
+
+    stats_port(port, width);
+
+    if (port_mode != PORTS_ADAPTIVE || count != PORT_PROMOTE_THRESHOLD) {
+        return;
+    }
+
+    // a multi-byte access is only let through by the CPU if every port it
+    // touches is granted, so promote the whole range or nothing
+    for (uint16_t i = 0; i < width; i++) {
+        if (!is_passthrough(port + i)) {
+            return;
+        }
+    }
+
+    // ioperm sets bits in our TSS I/O permission bitmap, which is what the
+    // CPU consults for IN/OUT in vm86 mode. it is independent of the iopl
+    // toggling in vm86_run, so granted ports stay accessible to DOS
+    if (ioperm(port, width, 1)) {
+        perror("warn: ioperm");
+    }
+}
+
+static uint32_t
+ones(uint16_t width)
+{
+    return 0xffffffff >> (32 - width * 8);
+}
+
+static uint32_t
+hw_in(uint16_t port, uint16_t width)
+{
+    switch (width) {
+        case 1: return inb(port);
+        case 2: return inw(port);
+        default: return inl(port);
+    }
+}
+
+static void
+hw_out(uint16_t port, uint16_t width, uint32_t value)
+{
+    switch (width) {
+        case 1: outb(value, port); break;
+        case 2: outw(value, port); break;
+        default: outl(value, port); break;
+    }
+}
+
+static uint32_t
+emulate_in(port_device_t* device, uint16_t port, uint16_t width)
+{
+    if (width == 4 && device->ind) {
+        return device->ind(device->dev, port);
+    }
+
+    if (width >= 2 && device->inw) {
+        uint32_t value = device->inw(device->dev, port);
+
+        if (width == 4) {
+            value |= emulate_in(device, port + 2, 2) << 16;
+        }
+
+        return value;
+    }
+
+    if (!device->inb) {
+        return ones(width);
+    }
+
+    uint32_t value = 0;
+
+    for (uint16_t i = 0; i < width; i++) {
+        value |= (uint32_t)device->inb(device->dev, port + i) << (i * 8);
+    }
+
+    return value;
+}
+
+static void
+emulate_out(port_device_t* device, uint16_t port, uint16_t width, uint32_t value)
+{
+    if (width == 4 && device->outd) {
+        device->outd(device->dev, port, value);
+        return;
+    }
+
+    if (width >= 2 && device->outw) {
+        device->outw(device->dev, port, value);
+
+        if (width == 4) {
+            emulate_out(device, port + 2, 2, value >> 16);
+        }
+
+        return;
+    }
+
+    if (!device->outb) {
+        return;
+    }
+
+    for (uint16_t i = 0; i < width; i++) {
+        device->outb(device->dev, port + i, value >> (i * 8));
+    }
+}
+
+// accesses to ports nobody has claimed are always worth a look, the rest only
+// when tracing everything
+static enum trace_level
+trace_level(port_device_t* device)
+{
+    return device->kind == PORT_LOG ? TRACE_LOG : TRACE_ALL;
+}
+
+uint32_t
+port_in(regs_t* regs, uint16_t port, uint16_t width)
+{
+    port_device_t* device = port_table[port];
+    uint32_t value;
+
+    port_trapped(port, width);
+
+    switch (device->kind) {
+        case PORT_PASSTHROUGH:
+        case PORT_LOG:
+            value = hw_in(port, width);
+            break;
+        case PORT_IGNORE:
+            value = ones(width);
+            break;
+        default:
+            value = emulate_in(device, port, width);
+            break;
+    }
+
+    trace(trace_level(device), TRACE_IN, regs, port, width, value);
+    return value;
+}
+
+void
+port_out(regs_t* regs, uint16_t port, uint16_t width, uint32_t value)
+{
+    port_device_t* device = port_table[port];
+
+    port_trapped(port, width);
+    trace(trace_level(device), TRACE_OUT, regs, port, width, value);
+
+    switch (device->kind) {
+        case PORT_PASSTHROUGH:
+        case PORT_LOG:
+            hw_out(port, width, value);
+            break;
+        case PORT_IGNORE:
+            break;
+        default:
+            emulate_out(device, port, width, value);
+            break;
+    }
+}
+
+void
+port_in_string(regs_t* regs, uint16_t port, uint16_t width, void* buf, uint32_t count)
+{
+    port_device_t* device = port_table[port];
+
+    // the whole string is one trap, however long it is
+    port_trapped(port, width);
+    trace(trace_level(device), TRACE_INS, regs, port, width, count);
+
+    switch (device->kind) {
+        case PORT_LOG:
+        case PORT_PASSTHROUGH:
+            switch (width) {
+                case 1: insb(port, buf, count); break;
+                case 2: insw(port, buf, count); break;
+                default: insl(port, buf, count); break;
+            }
+            break;
+        case PORT_IGNORE:
+            memset(buf, 0xff, (size_t)count * width);
+            break;
+        default:
+            for (uint8_t* ptr = buf; count; count--, ptr += width) {
+                uint32_t value = emulate_in(device, port, width);
+                memcpy(ptr, &value, width);
+            }
+            break;
+    }
+}
+
+void
+port_out_string(regs_t* regs, uint16_t port, uint16_t width, const void* buf, uint32_t count)
+{
+    port_device_t* device = port_table[port];
+
+    port_trapped(port, width);
+    trace(trace_level(device), TRACE_OUTS, regs, port, width, count);
+
+    switch (device->kind) {
+        case PORT_LOG:
+        case PORT_PASSTHROUGH:
+            switch (width) {
+                case 1: outsb(port, buf, count); break;
+                case 2: outsw(port, buf, count); break;
+                default: outsl(port, buf, count); break;
+            }
+            break;
+        case PORT_IGNORE:
+            break;
+        default:
+            for (const uint8_t* ptr = buf; count; count--, ptr += width) {
+                uint32_t value = 0;
+                memcpy(&value, ptr, width);
+                emulate_out(device, port, width, value);
+            }
+            break;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef PORT_H
+#define PORT_H
+
+#include <stdint.h>
+
+#include "vm86.h"
+
+enum port_kind {
+    // access goes straight to hardware. these ports are candidates for the
+    // I/O permission bitmap, see enum port_mode
+    PORT_PASSTHROUGH,
+    // reads return all ones, writes are dropped
+    PORT_IGNORE,
+    // access goes straight to hardware, but is logged
+    PORT_LOG,
+    // access is handled by the device's callbacks
+    PORT_EMULATE,
+};
+
+// a device owning a range of ports. for PORT_EMULATE devices, any callback
+// left NULL for a wider access is synthesized from byte accesses to
+// consecutive ports, and a missing byte callback reads all ones or drops the
+// write
+typedef struct port_device {
+    const char* name;
+    enum port_kind kind;
+    void* dev;
+
+    uint8_t (*inb)(void* dev, uint16_t port);
+    uint16_t (*inw)(void* dev, uint16_t port);
+    uint32_t (*ind)(void* dev, uint16_t port);
+
+    void (*outb)(void* dev, uint16_t port, uint8_t value);
+    void (*outw)(void* dev, uint16_t port, uint16_t value);
+    void (*outd)(void* dev, uint16_t port, uint32_t value);
+}
+port_device_t;
+
+// built in devices for the simple port kinds
+extern port_device_t port_passthrough;
+extern port_device_t port_ignore;
+extern port_device_t port_log;
+
+// resets every port to port_log and reads the dsl_ports mode
+void
+port_init();
+
+// assigns ports first through last inclusive to device
+void
+port_register(uint16_t first, uint16_t last, port_device_t* device);
+
+// grants registered passthrough ports to DOS according to the port mode,
+// call once all devices are registered
+void
+port_grant();
+
+// dispatch a trapped access of width 1, 2 or 4 bytes to the owning device.
+// regs is only used for logging
+uint32_t
+port_in(regs_t* regs, uint16_t port, uint16_t width);
+
+void
+port_out(regs_t* regs, uint16_t port, uint16_t width, uint32_t value);
+
+// dispatch a trapped INS/OUTS of count elements to or from buf
+void
+port_in_string(regs_t* regs, uint16_t port, uint16_t width, void* buf, uint32_t count);
+
+void
+port_out_string(regs_t* regs, uint16_t port, uint16_t width, const void* buf, uint32_t count);
+
+#endif
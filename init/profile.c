@@ -0,0 +1,242 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "mem.h"
+#include "panic.h"
+#include "profile.h"
+#include "task.h"
+
+// distinct program and CS:IP pairs kept, must be a power of two
+#define PROFILE_SLOTS 4096
+
+// a sane chain is much shorter, this stops us looping on a corrupt one
+#define MAX_MCBS 1024
+
+#define MCB_OWNER_FREE 0
+#define MCB_OWNER_DOS 8
+
+// DOS 4 and later keep the program name in the owner's MCB
+#define MCB_NAME_LEN 8
+
+typedef struct profile_slot {
+    uint32_t count;
+    uint16_t cs;
+    uint16_t ip;
+    char name[MCB_NAME_LEN + 1];
+}
+profile_slot_t;
+
+static task_t* profile_task;
+static uint16_t profile_first_mcb;
+static int profile_timerfd = -1;
+static uint32_t profile_hz;
+
+static profile_slot_t slots[PROFILE_SLOTS];
+static uint64_t idle_samples;
+static uint64_t dropped_samples;
+static uint32_t samples_since_flush;
+
+// names the owner of a PSP from its MCB, or by segment if it has no name
+static void
+psp_name(uint16_t psp, char* name)
+{
+    const char* mcb_name = linear(psp - 1, 8);
+    size_t len = 0;
+
+    while (len < MCB_NAME_LEN && mcb_name[len] > ' ' && mcb_name[len] < 0x7f) {
+        name[len] = mcb_name[len];
+        len++;
+    }
+
+    if (len == 0) {
+        sprintf(name, "psp_%04x", psp);
+    } else {
+        name[len] = 0;
+    }
+}
+
+// works out what owns the memory at lin by walking the MCB chain, falling
+// back on the fixed parts of the PC memory map for code outside of it
+static void
+owner_name(uint32_t lin, char* name)
+{
+    uint16_t seg = profile_first_mcb;
+
+    for (int i = 0; seg && i < MAX_MCBS; i++) {
+        uint8_t type = peek8(seg, 0);
+
+        if (type != 'M' && type != 'Z') {
+            // corrupt, or DOS is halfway through changing it
+            break;
+        }
+
+        uint16_t owner = peek16(seg, 1);
+        uint16_t size = peek16(seg, 3);
+        uint32_t start = (uint32_t)(seg + 1) << 4;
+
+        if (lin >= start && lin < start + ((uint32_t)size << 4)) {
+            if (owner == MCB_OWNER_FREE) {
+                strcpy(name, "[free]");
+            } else if (owner == MCB_OWNER_DOS) {
+                strcpy(name, "[dos]");
+            } else {
+                psp_name(owner, name);
+            }
+
+            return;
+        }
+
+        if (type == 'Z') {
+            break;
+        }
+
+        seg += size + 1;
+    }
+
+    if (lin >= 0x100000) {
+        strcpy(name, "[hma]");
+    } else if (lin >= 0xf0000) {
+        strcpy(name, "[bios]");
+    } else if (lin >= 0xc0000) {
+        strcpy(name, "[rom]");
+    } else if (lin >= 0xa0000) {
+        strcpy(name, "[video]");
+    } else {
+        // below the chain, the DOS kernel and device drivers
+        strcpy(name, "[dos]");
+    }
+}
+
+static void
+record(uint16_t cs, uint16_t ip)
+{
+    char name[MCB_NAME_LEN + 1];
+    owner_name(((uint32_t)cs << 4) + ip, name);
+
+    uint32_t hash = (cs * 31 + ip) * 2654435761u;
+
+    for (const char* c = name; *c; c++) {
+        hash = (hash ^ *c) * 16777619;
+    }
+
+    for (uint32_t i = 0; i < PROFILE_SLOTS; i++) {
+        profile_slot_t* slot = &slots[(hash + i) & (PROFILE_SLOTS - 1)];
+
+        if (slot->count == 0) {
+            *slot = (profile_slot_t) { .count = 1, .cs = cs, .ip = ip };
+            strcpy(slot->name, name);
+            return;
+        }
+
+        if (slot->cs == cs && slot->ip == ip && strcmp(slot->name, name) == 0) {
+            slot->count++;
+            return;
+        }
+    }
+
+    dropped_samples++;
+}
+
+// rewrites the profile, through a rename so readers never see it half done
+static void
+flush()
+{
+    FILE* file = fopen(PROFILE_PATH ".tmp", "w");
+
+    if (!file) {
+        perror("warn: write " PROFILE_PATH);
+        return;
+    }
+
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        profile_slot_t* slot = &slots[i];
+
+        if (slot->count) {
+            fprintf(file, "%s;%04x:%04x %u\n", slot->name, slot->cs, slot->ip, slot->count);
+        }
+    }
+
+    if (idle_samples) {
+        fprintf(file, "[idle] %llu\n", (unsigned long long)idle_samples);
+    }
+
+    if (dropped_samples) {
+        fprintf(file, "[dropped] %llu\n", (unsigned long long)dropped_samples);
+    }
+
+    fclose(file);
+    rename(PROFILE_PATH ".tmp", PROFILE_PATH);
+}
+
+// the timerfd firing forces an exit from the guest, so the registers hold
+// wherever DOS was when the sample was due
+static void
+on_sample(void* ctx, uint32_t events)
+{
+    (void)ctx;
+    (void)events;
+
+    uint64_t expirations;
+
+    if (read(profile_timerfd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    if (profile_task->idling) {
+        idle_samples++;
+    } else {
+        record(profile_task->regs->cs.word.lo, profile_task->regs->eip.word.lo);
+    }
+
+    // about once a second
+    if (++samples_since_flush >= profile_hz) {
+        samples_since_flush = 0;
+        flush();
+    }
+}
+
+void
+profile_init(task_t* task, uint16_t first_mcb)
+{
+    const char* param = getenv("dsl_profile");
+
+    if (param == NULL) {
+        return;
+    }
+
+    profile_hz = strtoul(param, NULL, 0);
+
+    if (profile_hz == 0 || profile_hz > 10000) {
+        printf("warn: bad dsl_profile rate '%s', not profiling\r\n", param);
+        return;
+    }
+
+    profile_task = task;
+    profile_first_mcb = first_mcb;
+
+    profile_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (profile_timerfd < 0) {
+        fatal("timerfd_create");
+    }
+
+    uint64_t period_ns = 1000000000 / profile_hz;
+
+    struct itimerspec spec = { 0 };
+    spec.it_value.tv_sec = period_ns / 1000000000;
+    spec.it_value.tv_nsec = period_ns % 1000000000;
+    spec.it_interval = spec.it_value;
+
+    if (timerfd_settime(profile_timerfd, 0, &spec, NULL)) {
+        fatal("timerfd_settime");
+    }
+
+    event_add(profile_timerfd, EPOLLIN, on_sample, NULL);
+}
@@ -0,0 +1,19 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#include "cli.h"
+#include "task.h"
+
+// samples of where DOS is spending its time, in the folded stack format
+// flamegraph.pl and friends read: "PROGRAM;CS:IP count" per line
+#define PROFILE_PATH DSL_RUN_DIR "/profile.folded"
+
+// starts sampling CS:IP at the rate given by the dsl_profile= kernel
+// parameter, if any. first_mcb is where the DOS memory chain starts, which
+// samples are attributed to programs from
+void
+profile_init(task_t* task, uint16_t first_mcb);
+
+#endif
@@ -0,0 +1,1262 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mem.h"
+#include "panic.h"
+#include "redir.h"
+#include "vfat.h"
+
+// DOS 4+ List of Lists
+#define LOL_CDS 0x16
+#define LOL_LASTDRIVE 0x21
+
+// DOS 4+ current directory structure, one per drive letter
+#define CDS_SIZE 0x58
+#define CDS_FLAGS 0x43
+#define CDS_ROOT_OFF 0x4f
+#define CDS_NETWORK 0x8000
+#define CDS_PHYSICAL 0x4000
+
+// DOS 4+ swappable data area
+#define SDA_DTA 0x0c
+#define SDA_FN1 0x9e
+#define SDA_FN2 0x11e
+#define SDA_FOUND 0x1b3
+#define SDA_SEARCH_ATTR 0x24d
+#define SDA_EXT_ACTION 0x2dd
+#define SDA_EXT_ATTR 0x2df
+#define SDA_EXT_MODE 0x2e1
+
+// device info word of files on the drive: remote, not written yet, and the
+// drive number in the low bits
+#define SFT_REMOTE 0x8000
+#define SFT_CLEAN 0x0040
+
+#define ATTR_READONLY 0x01
+#define ATTR_HIDDEN 0x02
+#define ATTR_SYSTEM 0x04
+#define ATTR_VOLUME 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_ARCHIVE 0x20
+
+#define ERR_FILE_NOT_FOUND 0x02
+#define ERR_PATH_NOT_FOUND 0x03
+#define ERR_TOO_MANY_FILES 0x04
+#define ERR_ACCESS_DENIED 0x05
+#define ERR_INVALID_HANDLE 0x06
+#define ERR_NO_MORE_FILES 0x12
+#define ERR_FILE_EXISTS 0x50
+
+// the start of a DOS 4+ system file table entry, as much as the redirector
+// fills in. ES:DI points at one for every call on an open file
+typedef struct redir_sft {
+    uint16_t handles;
+    uint16_t mode;
+    uint8_t attr;
+    uint16_t dev_info;
+    uint32_t dev_ptr;
+    // the first cluster on a local drive, our index into files
+    uint16_t file;
+    uint16_t time;
+    uint16_t date;
+    uint32_t size;
+    uint32_t pos;
+    uint16_t rel_cluster;
+    uint32_t dir_sector;
+    uint8_t dir_entry;
+    char name[11];
+}
+__attribute__((packed)) redir_sft_t;
+
+// search data block, kept by DOS at the start of the program's DTA between
+// FindFirst and FindNext
+typedef struct redir_sdb {
+    // drive number with bit 7 set for redirected drives
+    uint8_t drive;
+    char pattern[11];
+    uint8_t attr;
+    // next entry of the listing to return
+    uint16_t index;
+    // the directory cluster on a local drive, our index into searches
+    uint16_t search;
+    uint32_t serial;
+}
+__attribute__((packed)) redir_sdb_t;
+
+// directory entry as DOS stores it, what FindFirst and FindNext return
+typedef struct redir_dirent {
+    char name[11];
+    uint8_t attr;
+    uint8_t reserved[10];
+    uint16_t time;
+    uint16_t date;
+    uint16_t cluster;
+    uint32_t size;
+}
+__attribute__((packed)) redir_dirent_t;
+
+typedef struct redir_search {
+    // 0 when the slot is free
+    uint32_t serial;
+    uint16_t count;
+    redir_dirent_t* entries;
+}
+redir_search_t;
+
+// drive number, 0 for A:, or -1 when there is no drive
+static int drive = -1;
+static char root[PATH_MAX];
+
+// the DOS drive's device, when it is mounted, to keep off it
+static bool have_dos_dev;
+static dev_t dos_dev;
+
+static uint8_t* sda;
+static uint8_t* cds;
+
+static int files[REDIR_FILES];
+
+static redir_search_t searches[REDIR_SEARCHES];
+static uint32_t next_serial = 1;
+static int next_search;
+
+static void*
+far_ptr(const uint8_t* ptr)
+{
+    return linear(ptr[2] | ptr[3] << 8, ptr[0] | ptr[1] << 8);
+}
+
+static void
+succeed(regs_t* regs)
+{
+    regs->eflags.word.lo &= ~FLAG_CARRY;
+}
+
+static void
+fail(regs_t* regs, uint16_t error)
+{
+    regs->eax.word.lo = error;
+    regs->eflags.word.lo |= FLAG_CARRY;
+}
+
+static uint16_t
+dos_error(int err)
+{
+    switch (err) {
+        case ENOENT:
+            return ERR_FILE_NOT_FOUND;
+        case ENOTDIR:
+            return ERR_PATH_NOT_FOUND;
+        case EMFILE:
+        case ENFILE:
+            return ERR_TOO_MANY_FILES;
+        case EEXIST:
+            return ERR_FILE_EXISTS;
+        default:
+            return ERR_ACCESS_DENIED;
+    }
+}
+
+bool
+redir_fcb_name(const char* name, char fcb[11], bool wild)
+{
+    memset(fcb, ' ', 11);
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        memcpy(fcb, name, strlen(name));
+        return true;
+    }
+
+    size_t n = 0, end = 8;
+
+    for (const char* p = name; *p; p++) {
+        unsigned char c = *p;
+
+        if (c == '.' && end == 8 && n > 0) {
+            n = 8;
+            end = 11;
+            continue;
+        }
+
+        if (wild && c == '*') {
+            while (n < end) {
+                fcb[n++] = '?';
+            }
+            continue;
+        }
+
+        if (n == end) {
+            return false;
+        }
+
+        if (!(wild && c == '?')
+                && (c <= ' ' || c >= 0x7f || strchr("\"*+,./:;<=>?[\\]|", c))) {
+            return false;
+        }
+
+        fcb[n++] = toupper(c);
+    }
+
+    return n > 0 && !(end == 11 && n == 8);
+}
+
+bool
+redir_fcb_match(const char pattern[11], const char fcb[11])
+{
+    for (int i = 0; i < 11; i++) {
+        if (pattern[i] != '?' && pattern[i] != fcb[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+append(char path[PATH_MAX], const char* name)
+{
+    size_t len = strlen(path);
+
+    if (len + 1 + strlen(name) >= PATH_MAX) {
+        return false;
+    }
+
+    path[len] = '/';
+    strcpy(path + len + 1, name);
+    return true;
+}
+
+static bool
+on_dos_drive(const struct stat* st)
+{
+    return have_dos_dev && st->st_dev == dos_dev;
+}
+
+// appends the entry of directory path whose 8.3 name is fcb
+static bool
+lookup(char path[PATH_MAX], const char fcb[11])
+{
+    DIR* dir = opendir(path[0] ? path : "/");
+
+    if (dir == NULL) {
+        return false;
+    }
+
+    struct dirent* ent;
+    bool found = false;
+
+    while ((ent = readdir(dir)) != NULL) {
+        char name[11];
+
+        if (redir_fcb_name(ent->d_name, name, false) && memcmp(name, fcb, 11) == 0) {
+            found = append(path, ent->d_name);
+            break;
+        }
+    }
+
+    closedir(dir);
+    return found;
+}
+
+uint16_t
+redir_map_path(const char* dos, size_t len, char path[PATH_MAX], bool* exists)
+{
+    strcpy(path, root);
+    *exists = true;
+
+    size_t i = 2;
+
+    while (i < len) {
+        if (dos[i] == '\\') {
+            i++;
+            continue;
+        }
+
+        char name[13];
+        size_t n = 0;
+
+        while (i < len && dos[i] != '\\') {
+            if (n == sizeof(name) - 1) {
+                return ERR_PATH_NOT_FOUND;
+            }
+
+            name[n++] = dos[i++];
+        }
+
+        name[n] = 0;
+
+        bool last = i >= len || i + 1 >= len;
+        char fcb[11];
+
+        if (!*exists || !redir_fcb_name(name, fcb, false)) {
+            return ERR_PATH_NOT_FOUND;
+        }
+
+        if (!lookup(path, fcb)) {
+            if (!last) {
+                return ERR_PATH_NOT_FOUND;
+            }
+
+            for (char* p = name; *p; p++) {
+                *p = tolower((unsigned char)*p);
+            }
+
+            if (!append(path, name)) {
+                return ERR_PATH_NOT_FOUND;
+            }
+
+            *exists = false;
+        }
+    }
+
+    if (path[0] == 0) {
+        strcpy(path, "/");
+    }
+
+    // whatever symlinks lead onto the DOS drive are off limits. for a
+    // missing file check the directory it would go in
+    struct stat st;
+    char* slash = *exists ? NULL : strrchr(path, '/');
+
+    if (slash) {
+        *slash = 0;
+    }
+
+    bool on_dos = stat(path[0] ? path : "/", &st) == 0 && on_dos_drive(&st);
+
+    if (slash) {
+        *slash = '/';
+    }
+
+    return on_dos ? ERR_ACCESS_DENIED : 0;
+}
+
+// splits a DOS path at its last backslash
+static size_t
+dir_len(const char* dos)
+{
+    const char* slash = strrchr(dos, '\\');
+    return slash ? (size_t)(slash - dos) : strlen(dos);
+}
+
+static const char*
+base_name(const char* dos)
+{
+    const char* slash = strrchr(dos, '\\');
+    return slash ? slash + 1 : dos;
+}
+
+// DOS time in the low word, date in the high
+static uint32_t
+dos_time(time_t t)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+
+    if (tm.tm_year < 80) {
+        // 1980-01-01, as early as DOS goes
+        return (1 << 5 | 1) << 16;
+    }
+
+    uint16_t time = tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2;
+    uint16_t date = (tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday;
+    return (uint32_t)date << 16 | time;
+}
+
+static uint8_t
+dos_attr(const struct stat* st)
+{
+    if (S_ISDIR(st->st_mode)) {
+        return ATTR_DIRECTORY;
+    }
+
+    return ATTR_ARCHIVE | (st->st_mode & S_IWUSR ? 0 : ATTR_READONLY);
+}
+
+static uint32_t
+dos_size(const struct stat* st)
+{
+    return st->st_size > UINT32_MAX ? UINT32_MAX : st->st_size;
+}
+
+// what a file in linux directory dir looks like to FindFirst. false for
+// names that don't fit 8.3 and things other than files and directories
+static bool
+make_dirent(const char* dir, const char* name, redir_dirent_t* ent)
+{
+    memset(ent, 0, sizeof(*ent));
+
+    if (!redir_fcb_name(name, ent->name, false)) {
+        return false;
+    }
+
+    char path[PATH_MAX];
+    struct stat st;
+
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, name) >= sizeof(path)
+            || stat(path, &st) < 0
+            || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))
+            || on_dos_drive(&st)) {
+        return false;
+    }
+
+    ent->attr = dos_attr(&st);
+    ent->size = S_ISDIR(st.st_mode) ? 0 : dos_size(&st);
+    uint32_t stamp = dos_time(st.st_mtime);
+    ent->time = stamp;
+    ent->date = stamp >> 16;
+    return true;
+}
+
+static int
+file_fd(redir_sft_t* sft)
+{
+    return sft->file < REDIR_FILES ? files[sft->file] : -1;
+}
+
+// opens path for an uninitialised SFT at ES:DI and fills it in
+static void
+open_file(regs_t* regs, const char* path, int flags, uint16_t mode)
+{
+    redir_sft_t* sft = linear(regs->es16.word.lo, regs->edi.word.lo);
+    int slot = 0;
+
+    while (slot < REDIR_FILES && files[slot] >= 0) {
+        slot++;
+    }
+
+    if (slot == REDIR_FILES) {
+        fail(regs, ERR_TOO_MANY_FILES);
+        return;
+    }
+
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    struct stat st;
+
+    if (fd < 0) {
+        fail(regs, dos_error(errno));
+        return;
+    }
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        fail(regs, ERR_ACCESS_DENIED);
+        return;
+    }
+
+    files[slot] = fd;
+
+    sft->mode = (sft->mode & 0xff00) | (mode & 0xff);
+    sft->attr = dos_attr(&st);
+    sft->dev_info = SFT_REMOTE | SFT_CLEAN | drive;
+    sft->dev_ptr = 0;
+    sft->file = slot;
+    uint32_t stamp = dos_time(st.st_mtime);
+    sft->time = stamp;
+    sft->date = stamp >> 16;
+    sft->size = dos_size(&st);
+    sft->pos = 0;
+    sft->rel_cluster = 0xffff;
+    sft->dir_sector = 0;
+    sft->dir_entry = 0xff;
+    redir_fcb_name(base_name((char*)sda + SDA_FN1), sft->name, false);
+
+    succeed(regs);
+}
+
+static int
+open_flags(uint16_t mode)
+{
+    switch (mode & 3) {
+        case 0:
+            return O_RDONLY;
+        case 1:
+            return O_WRONLY;
+        default:
+            return O_RDWR;
+    }
+}
+
+static void
+do_open(regs_t* regs)
+{
+    // open mode is on the stack
+    uint16_t mode = peek16(regs->ss.word.lo, regs->esp.word.lo);
+    char path[PATH_MAX];
+    bool exists;
+    uint16_t err = redir_map_path((char*)sda + SDA_FN1, strlen((char*)sda + SDA_FN1), path, &exists);
+
+    if (err || !exists) {
+        fail(regs, err ? err : ERR_FILE_NOT_FOUND);
+        return;
+    }
+
+    open_file(regs, path, open_flags(mode), mode);
+}
+
+static void
+do_create(regs_t* regs)
+{
+    // attribute is on the stack
+    uint16_t attr = peek16(regs->ss.word.lo, regs->esp.word.lo);
+    char path[PATH_MAX];
+    bool exists;
+    uint16_t err = redir_map_path((char*)sda + SDA_FN1, strlen((char*)sda + SDA_FN1), path, &exists);
+
+    if (err) {
+        fail(regs, err);
+        return;
+    }
+
+    if (attr & (ATTR_VOLUME | ATTR_DIRECTORY)) {
+        fail(regs, ERR_ACCESS_DENIED);
+        return;
+    }
+
+    open_file(regs, path, O_RDWR | O_CREAT | O_TRUNC, 2);
+}
+
+static void
+do_extended_open(regs_t* regs)
+{
+    uint16_t action = *(uint16_t*)(sda + SDA_EXT_ACTION);
+    uint16_t mode = *(uint16_t*)(sda + SDA_EXT_MODE) & 0x7f;
+    char path[PATH_MAX];
+    bool exists;
+    uint16_t err = redir_map_path((char*)sda + SDA_FN1, strlen((char*)sda + SDA_FN1), path, &exists);
+    uint16_t result;
+    int flags = open_flags(mode);
+
+    if (err) {
+        fail(regs, err);
+        return;
+    }
+
+    if (exists) {
+        switch (action & 0x0f) {
+            case 1:
+                result = 1;
+                break;
+            case 2:
+                flags |= O_TRUNC;
+                result = 3;
+                break;
+            default:
+                fail(regs, ERR_FILE_EXISTS);
+                return;
+        }
+    } else if ((action & 0xf0) == 0x10) {
+        if (*(uint16_t*)(sda + SDA_EXT_ATTR) & (ATTR_VOLUME | ATTR_DIRECTORY)) {
+            fail(regs, ERR_ACCESS_DENIED);
+            return;
+        }
+
+        flags |= O_CREAT;
+        result = 2;
+    } else {
+        fail(regs, ERR_FILE_NOT_FOUND);
+        return;
+    }
+
+    open_file(regs, path, flags, mode);
+
+    if (!(regs->eflags.word.lo & FLAG_CARRY)) {
+        regs->ecx.word.lo = result;
+    }
+}
+
+static void
+do_close(regs_t* regs, redir_sft_t* sft)
+{
+    int fd = file_fd(sft);
+
+    if (fd < 0) {
+        fail(regs, ERR_INVALID_HANDLE);
+        return;
+    }
+
+    // DOS calls this for every handle referring to the file, it is only
+    // really closed with the last
+    if (sft->handles > 0) {
+        sft->handles--;
+    }
+
+    if (sft->handles == 0) {
+        close(fd);
+        files[sft->file] = -1;
+    }
+
+    succeed(regs);
+}
+
+static void
+do_read(regs_t* regs, redir_sft_t* sft)
+{
+    int fd = file_fd(sft);
+
+    if (fd < 0) {
+        fail(regs, ERR_INVALID_HANDLE);
+        return;
+    }
+
+    // straight into the caller's buffer, which DOS passes as the DTA
+    ssize_t n = pread(fd, far_ptr(sda + SDA_DTA), regs->ecx.word.lo, sft->pos);
+
+    if (n < 0) {
+        fail(regs, dos_error(errno));
+        return;
+    }
+
+    sft->pos += n;
+    regs->ecx.word.lo = n;
+    succeed(regs);
+}
+
+static void
+do_write(regs_t* regs, redir_sft_t* sft)
+{
+    int fd = file_fd(sft);
+    ssize_t n;
+
+    if (fd < 0) {
+        fail(regs, ERR_INVALID_HANDLE);
+        return;
+    }
+
+    if (regs->ecx.word.lo == 0) {
+        // writing nothing truncates or extends the file to the position
+        n = ftruncate(fd, sft->pos);
+        sft->size = sft->pos;
+    } else {
+        n = pwrite(fd, far_ptr(sda + SDA_DTA), regs->ecx.word.lo, sft->pos);
+    }
+
+    if (n < 0) {
+        fail(regs, dos_error(errno));
+        return;
+    }
+
+    sft->pos += n;
+    sft->dev_info &= ~SFT_CLEAN;
+
+    if (sft->pos > sft->size) {
+        sft->size = sft->pos;
+    }
+
+    regs->ecx.word.lo = n;
+    succeed(regs);
+}
+
+static void
+do_seek_end(regs_t* regs, redir_sft_t* sft)
+{
+    int fd = file_fd(sft);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fail(regs, ERR_INVALID_HANDLE);
+        return;
+    }
+
+    int32_t offset = (uint32_t)regs->ecx.word.lo << 16 | regs->edx.word.lo;
+    int64_t pos = (int64_t)dos_size(&st) + offset;
+
+    if (pos < 0) {
+        pos = 0;
+    }
+
+    sft->pos = pos > UINT32_MAX ? UINT32_MAX : pos;
+    regs->edx.word.lo = sft->pos >> 16;
+    regs->eax.word.lo = sft->pos;
+    succeed(regs);
+}
+
+static void
+do_disk_space(regs_t* regs)
+{
+    struct statvfs vfs;
+
+    if (statvfs(root[0] ? root : "/", &vfs) < 0) {
+        fail(regs, dos_error(errno));
+        return;
+    }
+
+    // 32K clusters, capped at what 16 bits can count. DOS can't tell about
+    // more than 2G anyway
+    uint64_t cluster = 32768;
+    uint64_t total = (uint64_t)vfs.f_blocks * vfs.f_frsize / cluster;
+    uint64_t avail = (uint64_t)vfs.f_bavail * vfs.f_frsize / cluster;
+
+    regs->eax.word.lo = cluster / 512;
+    regs->ebx.word.lo = total > 0xffff ? 0xffff : total;
+    regs->ecx.word.lo = 512;
+    regs->edx.word.lo = avail > 0xffff ? 0xffff : avail;
+    succeed(regs);
+}
+
+static void
+do_path_call(regs_t* regs, uint8_t func)
+{
+    const char* fn1 = (char*)sda + SDA_FN1;
+    char path[PATH_MAX];
+    bool exists;
+    uint16_t err = redir_map_path(fn1, strlen(fn1), path, &exists);
+    struct stat st;
+
+    if (err) {
+        fail(regs, err);
+        return;
+    }
+
+    if (func == 0x03) {
+        // mkdir
+        if (exists || mkdir(path, 0777) < 0) {
+            fail(regs, exists ? ERR_ACCESS_DENIED : dos_error(errno));
+            return;
+        }
+
+        succeed(regs);
+        return;
+    }
+
+    if (!exists || stat(path, &st) < 0) {
+        fail(regs, func == 0x01 || func == 0x05 ? ERR_PATH_NOT_FOUND : ERR_FILE_NOT_FOUND);
+        return;
+    }
+
+    switch (func) {
+        case 0x01: {
+            // rmdir
+            if (!S_ISDIR(st.st_mode)) {
+                fail(regs, ERR_PATH_NOT_FOUND);
+                return;
+            }
+
+            if (rmdir(path) < 0) {
+                fail(regs, ERR_ACCESS_DENIED);
+                return;
+            }
+
+            break;
+        }
+        case 0x05: {
+            // chdir, DOS updates the CDS itself once we say it exists
+            if (!S_ISDIR(st.st_mode)) {
+                fail(regs, ERR_PATH_NOT_FOUND);
+                return;
+            }
+
+            break;
+        }
+        case 0x0e: {
+            // set attributes, only read only means anything here
+            uint16_t attr = peek16(regs->ss.word.lo, regs->esp.word.lo);
+            mode_t mode = st.st_mode & 07777;
+
+            mode = attr & ATTR_READONLY ? mode & ~0222 : mode | S_IWUSR;
+
+            if (chmod(path, mode) < 0) {
+                fail(regs, dos_error(errno));
+                return;
+            }
+
+            break;
+        }
+        case 0x0f: {
+            // get attributes, size in BX:DI
+            uint32_t size = S_ISDIR(st.st_mode) ? 0 : dos_size(&st);
+            uint32_t stamp = dos_time(st.st_mtime);
+
+            regs->eax.word.lo = dos_attr(&st);
+            regs->ebx.word.lo = size >> 16;
+            regs->edi.word.lo = size;
+            regs->ecx.word.lo = stamp;
+            regs->edx.word.lo = stamp >> 16;
+            break;
+        }
+        case 0x11: {
+            // rename to the second filename
+            const char* fn2 = (char*)sda + SDA_FN2;
+            char to[PATH_MAX];
+            bool to_exists;
+
+            err = redir_map_path(fn2, strlen(fn2), to, &to_exists);
+
+            if (err || to_exists) {
+                fail(regs, err ? err : ERR_ACCESS_DENIED);
+                return;
+            }
+
+            if (rename(path, to) < 0) {
+                fail(regs, dos_error(errno));
+                return;
+            }
+
+            break;
+        }
+    }
+
+    succeed(regs);
+}
+
+// deletes the files matching the last component of the first filename,
+// which may have wildcards
+static void
+do_delete(regs_t* regs)
+{
+    const char* fn1 = (char*)sda + SDA_FN1;
+    char dir_path[PATH_MAX];
+    char pattern[11];
+    bool exists;
+    uint16_t err = redir_map_path(fn1, dir_len(fn1), dir_path, &exists);
+
+    if (err || !exists) {
+        fail(regs, err ? err : ERR_PATH_NOT_FOUND);
+        return;
+    }
+
+    if (!redir_fcb_name(base_name(fn1), pattern, true)) {
+        fail(regs, ERR_FILE_NOT_FOUND);
+        return;
+    }
+
+    DIR* dir = opendir(dir_path);
+
+    if (dir == NULL) {
+        fail(regs, ERR_PATH_NOT_FOUND);
+        return;
+    }
+
+    struct dirent* ent;
+    int deleted = 0;
+
+    while ((ent = readdir(dir)) != NULL) {
+        redir_dirent_t found;
+
+        if (!make_dirent(dir_path, ent->d_name, &found)
+                || !redir_fcb_match(pattern, found.name)
+                || (found.attr & (ATTR_DIRECTORY | ATTR_READONLY))) {
+            continue;
+        }
+
+        if (unlinkat(dirfd(dir), ent->d_name, 0) == 0) {
+            deleted++;
+        }
+    }
+
+    closedir(dir);
+
+    if (deleted == 0) {
+        fail(regs, ERR_FILE_NOT_FOUND);
+        return;
+    }
+
+    succeed(regs);
+}
+
+// hands out the next entry of a search, into the SDA where DOS copies it to
+// the program's DTA from
+static void
+next_entry(regs_t* regs, redir_sdb_t* sdb)
+{
+    redir_search_t* search = &searches[sdb->search % REDIR_SEARCHES];
+
+    if (search->serial != sdb->serial || sdb->index >= search->count) {
+        if (search->serial == sdb->serial) {
+            free(search->entries);
+            *search = (redir_search_t) { 0 };
+        }
+
+        fail(regs, ERR_NO_MORE_FILES);
+        return;
+    }
+
+    memcpy(sda + SDA_FOUND, &search->entries[sdb->index++], sizeof(redir_dirent_t));
+    succeed(regs);
+}
+
+// lists the whole directory once up front, so FindNext is a copy out of the
+// listing
+static void
+do_find_first(regs_t* regs)
+{
+    const char* fn1 = (char*)sda + SDA_FN1;
+    uint8_t attr = sda[SDA_SEARCH_ATTR];
+    char dir_path[PATH_MAX];
+    char pattern[11];
+    bool exists;
+    uint16_t err = redir_map_path(fn1, dir_len(fn1), dir_path, &exists);
+
+    if (err || !exists) {
+        fail(regs, err ? err : ERR_PATH_NOT_FOUND);
+        return;
+    }
+
+    if (attr == ATTR_VOLUME || !redir_fcb_name(base_name(fn1), pattern, true)) {
+        // no volume label
+        fail(regs, ERR_NO_MORE_FILES);
+        return;
+    }
+
+    DIR* dir = opendir(dir_path);
+
+    if (dir == NULL) {
+        fail(regs, ERR_PATH_NOT_FOUND);
+        return;
+    }
+
+    bool is_root = dir_len(fn1) <= 2;
+    redir_search_t* search = &searches[next_search];
+    next_search = (next_search + 1) % REDIR_SEARCHES;
+
+    free(search->entries);
+    *search = (redir_search_t) { .serial = next_serial++ };
+
+    if (next_serial == 0) {
+        next_serial = 1;
+    }
+
+    struct dirent* ent;
+    size_t capacity = 0;
+
+    while ((ent = readdir(dir)) != NULL && search->count < 0xffff) {
+        redir_dirent_t found;
+
+        if (is_root && ent->d_name[0] == '.' && (ent->d_name[1] == 0
+                || (ent->d_name[1] == '.' && ent->d_name[2] == 0))) {
+            continue;
+        }
+
+        if (!make_dirent(dir_path, ent->d_name, &found)
+                || !redir_fcb_match(pattern, found.name)
+                || (found.attr & (ATTR_HIDDEN | ATTR_SYSTEM | ATTR_DIRECTORY) & ~attr)) {
+            continue;
+        }
+
+        if (search->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            search->entries = realloc(search->entries, capacity * sizeof(redir_dirent_t));
+
+            if (search->entries == NULL) {
+                fatal("realloc");
+            }
+        }
+
+        search->entries[search->count++] = found;
+    }
+
+    closedir(dir);
+
+    redir_sdb_t* sdb = far_ptr(sda + SDA_DTA);
+
+    sdb->drive = drive | 0x80;
+    memcpy(sdb->pattern, pattern, sizeof(pattern));
+    sdb->attr = attr;
+    sdb->index = 0;
+    sdb->search = search - searches;
+    sdb->serial = search->serial;
+
+    next_entry(regs, sdb);
+}
+
+// works out whether a redirector call is about our drive
+static bool
+is_ours(regs_t* regs, uint8_t func)
+{
+    void* es_di = linear(regs->es16.word.lo, regs->edi.word.lo);
+    const char* fn1 = (char*)sda + SDA_FN1;
+
+    switch (func) {
+        case 0x06:
+        case 0x07:
+        case 0x08:
+        case 0x09:
+        case 0x0a:
+        case 0x0b:
+        case 0x21: {
+            redir_sft_t* sft = es_di;
+            return (sft->dev_info & SFT_REMOTE) && (sft->dev_info & 0x3f) == drive;
+        }
+        case 0x0c:
+            return es_di == cds;
+        case 0x1c: {
+            redir_sdb_t* sdb = es_di;
+            return sdb->drive == (drive | 0x80);
+        }
+        case 0x01:
+        case 0x03:
+        case 0x05:
+        case 0x0e:
+        case 0x0f:
+        case 0x11:
+        case 0x13:
+        case 0x16:
+        case 0x17:
+        case 0x1b:
+        case 0x2e:
+            return toupper((unsigned char)fn1[0]) == 'A' + drive && fn1[1] == ':';
+        default:
+            return false;
+    }
+}
+
+// whether a redirector call can leave linux with dirty data
+static bool
+changes_files(uint8_t func)
+{
+    switch (func) {
+        case 0x01:
+        case 0x03:
+        case 0x06:
+        case 0x07:
+        case 0x09:
+        case 0x0e:
+        case 0x11:
+        case 0x13:
+        case 0x17:
+        case 0x2e:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool
+redir_int(regs_t* regs)
+{
+    if (drive < 0 || regs->eax.byte.hi != 0x11) {
+        return false;
+    }
+
+    uint8_t func = regs->eax.byte.lo;
+
+    if (!is_ours(regs, func)) {
+        return false;
+    }
+
+    redir_sft_t* sft = linear(regs->es16.word.lo, regs->edi.word.lo);
+
+    switch (func) {
+        case 0x01:
+        case 0x03:
+        case 0x05:
+        case 0x0e:
+        case 0x0f:
+        case 0x11:
+            do_path_call(regs, func);
+            break;
+        case 0x06:
+            do_close(regs, sft);
+            break;
+        case 0x07: {
+            // commit
+            int fd = file_fd(sft);
+
+            if (fd >= 0) {
+                fdatasync(fd);
+            }
+
+            succeed(regs);
+            break;
+        }
+        case 0x08:
+            do_read(regs, sft);
+            break;
+        case 0x09:
+            do_write(regs, sft);
+            break;
+        case 0x0a:
+        case 0x0b:
+            // lock and unlock, nobody else is sharing these files with DOS
+            succeed(regs);
+            break;
+        case 0x0c:
+            do_disk_space(regs);
+            break;
+        case 0x13:
+            do_delete(regs);
+            break;
+        case 0x16:
+            do_open(regs);
+            break;
+        case 0x17:
+            do_create(regs);
+            break;
+        case 0x1b:
+            do_find_first(regs);
+            break;
+        case 0x1c:
+            next_entry(regs, (redir_sdb_t*)sft);
+            break;
+        case 0x21:
+            do_seek_end(regs, sft);
+            break;
+        case 0x2e:
+            do_extended_open(regs);
+            break;
+    }
+
+    // the served directory can be on the persistent overlay, a file on the
+    // DOS drive, and DOS goes on using the disk as soon as this returns
+    if (changes_files(func)) {
+        vfat_flush();
+    }
+
+    return true;
+}
+
+// parses dsl_drive=X[:dir], returning the drive letter wanted, 0 for the
+// first free one if X is *, or -1 for no drive
+static int
+drive_param()
+{
+    const char* param = getenv("dsl_drive");
+
+    strcpy(root, REDIR_ROOT);
+
+    if (param == NULL || strcmp(param, "off") == 0) {
+        return -1;
+    }
+
+    if (!(isalpha((unsigned char)param[0]) || param[0] == '*')
+            || (param[1] != 0 && param[1] != ':')
+            || (param[1] == ':' && strlen(param + 2) >= sizeof(root))) {
+        printf("warn: bad dsl_drive '%s', not serving linux files to DOS\r\n", param);
+        return -1;
+    }
+
+    if (param[1] == ':' && param[2] != 0) {
+        strcpy(root, param + 2);
+    }
+
+    return param[0] == '*' ? 0 : toupper((unsigned char)param[0]);
+}
+
+// true if either directory is inside the other, or they are the same
+static bool
+overlaps(const char* a, const char* b)
+{
+    size_t a_len = strlen(a), b_len = strlen(b);
+
+    if (a_len > b_len) {
+        return overlaps(b, a);
+    }
+
+    return strcmp(a, "/") == 0
+        || (strncmp(a, b, a_len) == 0 && (b[a_len] == 0 || b[a_len] == '/'));
+}
+
+// resolves root, refusing it if the DOS drive is in there or it is on the DOS
+// drive. notes the DOS drive's device so map_path can keep off it
+static bool
+check_root()
+{
+    char resolved[PATH_MAX];
+    struct stat st, parent;
+
+    if (mkdir(root, 0755) < 0 && errno != EEXIST) {
+        printf("warn: can't create %s for the linux drive: %s\r\n", root, strerror(errno));
+        return false;
+    }
+
+    if (realpath(root, resolved) == NULL) {
+        printf("warn: can't serve %s to DOS: %s\r\n", root, strerror(errno));
+        return false;
+    }
+
+    if (overlaps(resolved, VFAT_MOUNT)) {
+        printf("warn: not serving %s to DOS, it overlaps the DOS drive at " VFAT_MOUNT "\r\n", resolved);
+        return false;
+    }
+
+    // only a mount point has a different device to its parent
+    if (stat(VFAT_MOUNT, &st) == 0 && stat(VFAT_MOUNT "/..", &parent) == 0
+            && st.st_dev != parent.st_dev) {
+        have_dos_dev = true;
+        dos_dev = st.st_dev;
+    }
+
+    if (stat(resolved, &st) < 0 || on_dos_drive(&st)) {
+        printf("warn: not serving %s to DOS, it is on the DOS drive\r\n", resolved);
+        return false;
+    }
+
+    // served paths are built by appending /NAME, so "/" becomes ""
+    strcpy(root, strcmp(resolved, "/") == 0 ? "" : resolved);
+    return true;
+}
+
+bool
+redir_init(const vm86_init_t* init)
+{
+    int letter = drive_param();
+
+    if (letter < 0) {
+        return false;
+    }
+
+    // the List of Lists, CDS and SDA offsets used here are for DOS 4 on,
+    // earlier versions have other things there
+    if (init->dos_version >> 8 < 4) {
+        printf("warn: the linux drive needs DOS 4 or later, this is %d.%02d\r\n",
+            init->dos_version >> 8, init->dos_version & 0xff);
+        return false;
+    }
+
+    if (!check_root()) {
+        return false;
+    }
+
+    uint8_t* lol = linear(init->lol_seg, init->lol_off);
+    uint8_t* cds_array = far_ptr(lol + LOL_CDS);
+    int lastdrive = lol[LOL_LASTDRIVE];
+
+    sda = linear(init->sda_seg, init->sda_off);
+
+    if (letter == 0) {
+        // first letter after C: that DOS has nothing on
+        for (int i = 2; i < lastdrive; i++) {
+            uint16_t flags = *(uint16_t*)(cds_array + i * CDS_SIZE + CDS_FLAGS);
+
+            if (!(flags & (CDS_NETWORK | CDS_PHYSICAL))) {
+                letter = 'A' + i;
+                break;
+            }
+        }
+
+        if (letter == 0) {
+            printf("warn: no free drive letter for linux files, raise LASTDRIVE in CONFIG.SYS\r\n");
+            return false;
+        }
+    } else if (letter - 'A' >= lastdrive) {
+        printf("warn: drive %c: is past LASTDRIVE=%c in CONFIG.SYS\r\n", letter, 'A' + lastdrive - 1);
+        return false;
+    }
+
+    drive = letter - 'A';
+    cds = cds_array + drive * CDS_SIZE;
+
+    // the path DOS shows for the drive, and where its root backslash is
+    memset(cds, 0, CDS_SIZE);
+    snprintf((char*)cds, CDS_SIZE, "%c:\\", letter);
+    *(uint16_t*)(cds + CDS_FLAGS) = CDS_NETWORK | CDS_PHYSICAL;
+    *(uint16_t*)(cds + CDS_ROOT_OFF) = 2;
+
+    for (int i = 0; i < REDIR_FILES; i++) {
+        files[i] = -1;
+    }
+
+    return true;
+}
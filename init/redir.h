@@ -0,0 +1,66 @@
+#ifndef REDIR_H
+#define REDIR_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vm86.h"
+
+// a DOS drive letter backed by a linux directory, served straight from the
+// supervisor through the INT 2Fh AH=11h network redirector interface. DOS
+// hands every file call on a drive marked as networked in its current
+// directory structure to INT 2Fh, which the VMM traps, so opens, reads,
+// writes and directory searches on the drive become plain linux syscalls
+// against guest memory with no FAT or BIOS disk calls in between.
+//
+// only names that fit 8.3 are visible from DOS. the drive is off unless
+// dsl_drive= asks for it, see the README. needs DOS 4 or later for the layout
+// of the swappable data area.
+//
+// nothing on the DOS drive itself is ever served: linux writing to it through
+// its vfat cache while DOS writes through its own FAT buffers would corrupt
+// it. a directory containing VFAT_MOUNT is refused, and anything else that
+// leads onto the DOS drive, like a symlink, is hidden. the served directory
+// can still sit on the persistent overlay, which is a file on the DOS drive,
+// so every call that changes something is flushed through before DOS goes on
+
+// default linux directory served, created if missing
+#define REDIR_ROOT "/root"
+
+// files DOS can have open on the drive at once
+#define REDIR_FILES 64
+
+// FindFirst listings kept for FindNext. the oldest is dropped when a search
+// starts with none free, as DOS never says when it is done with one
+#define REDIR_SEARCHES 16
+
+// marks a drive letter as ours in the DOS current directory structure. true
+// if INT 2Fh needs trapping for redir_int
+bool
+redir_init(const vm86_init_t* init);
+
+// handles a redirector call if it is for our drive. false if it should go to
+// whatever DOS has on INT 2Fh instead
+bool
+redir_int(regs_t* regs);
+
+// converts a file name to the blank padded, upper case 11 byte form DOS keeps
+// in directory entries. with wild, * and ? are allowed and * becomes ?s.
+// false if the name does not fit 8.3
+bool
+redir_fcb_name(const char* name, char fcb[11], bool wild);
+
+// whether an 11 byte name matches a pattern from redir_fcb_name
+bool
+redir_fcb_match(const char pattern[11], const char fcb[11]);
+
+// maps the first len bytes of a fully qualified DOS path on our drive, like
+// L:\DIR\FILE.TXT, to a linux path. components are matched case insensitively
+// against what is there. a missing last one is lower cased so it can be
+// created, with exists false. returns 0 or a DOS error
+uint16_t
+redir_map_path(const char* dos, size_t len, char path[PATH_MAX], bool* exists);
+
+#endif
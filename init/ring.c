@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "mem.h"
+#include "panic.h"
+#include "ring.h"
+
+static ring_header_t* header;
+static uint8_t* data;
+
+static int listen_fd = -1;
+static int client_fd = -1;
+
+// the client's socket buffer is full, leave messages in the ring until it
+// drains
+static bool client_full;
+
+static void
+close_client()
+{
+    event_del(client_fd);
+    close(client_fd);
+    client_fd = -1;
+    client_full = false;
+}
+
+static void
+on_client(void* ctx, uint32_t events)
+{
+    (void)ctx;
+
+    if (events & (EPOLLHUP | EPOLLERR | EPOLLIN)) {
+        // clients only receive, anything else is them going away
+        close_client();
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        client_full = false;
+        event_modify(client_fd, EPOLLIN);
+        ring_drain();
+    }
+}
+
+static void
+on_accept(void* ctx, uint32_t events)
+{
+    (void)ctx;
+    (void)events;
+
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (fd < 0) {
+        return;
+    }
+
+    if (client_fd >= 0) {
+        printf("warn: ring already has a client\r\n");
+        close(fd);
+        return;
+    }
+
+    client_fd = fd;
+    event_add(fd, EPOLLIN, on_client, NULL);
+}
+
+void
+ring_init()
+{
+    header = linear(RING_SEG, RING_OFF);
+    data = (uint8_t*)(header + 1);
+
+    *header = (ring_header_t) {
+        .size = RING_SIZE,
+    };
+
+    // magic last, DOS checks it to see whether the ring is there
+    __atomic_store_n(&header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listen_fd < 0) {
+        fatal("ring socket");
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, RING_SOCKET_PATH);
+    unlink(RING_SOCKET_PATH);
+
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        fatal("bind " RING_SOCKET_PATH);
+    }
+
+    if (listen(listen_fd, 1)) {
+        fatal("listen " RING_SOCKET_PATH);
+    }
+
+    event_add(listen_fd, EPOLLIN, on_accept, NULL);
+}
+
+// sends one message, false if the client cannot take it yet
+static bool
+send_message(uint16_t type, uint8_t* payload, uint16_t len)
+{
+    struct iovec iov[] = {
+        { .iov_base = &type, .iov_len = sizeof(type) },
+        { .iov_base = payload, .iov_len = len },
+    };
+
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+    if (sendmsg(client_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) {
+        return true;
+    }
+
+    if (errno == EAGAIN) {
+        client_full = true;
+        event_modify(client_fd, EPOLLIN | EPOLLOUT);
+        return false;
+    }
+
+    // gone, the message is dropped along with it
+    close_client();
+    header->dropped++;
+    return true;
+}
+
+void
+ring_drain()
+{
+    uint16_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    uint16_t tail = header->tail;
+
+    if (head == tail || client_full) {
+        return;
+    }
+
+    // records are 4 byte aligned and never more than the ring's worth ahead
+    bool corrupt = (head & 3) || (uint16_t)(head - tail) > RING_SIZE;
+
+    while (!corrupt && tail != head) {
+        uint16_t off = tail & (RING_SIZE - 1);
+
+        if (off > RING_SIZE - 4) {
+            corrupt = true;
+            break;
+        }
+
+        uint16_t len = data[off] | data[off + 1] << 8;
+        uint16_t type = data[off + 2] | data[off + 3] << 8;
+        uint16_t step = type == RING_PAD ? RING_SIZE - off : (4 + len + 3) & ~3;
+
+        if (step > (uint16_t)(head - tail) ||
+            (type != RING_PAD && (len > RING_MAX_PAYLOAD || off + 4 + len > RING_SIZE))) {
+            corrupt = true;
+            break;
+        }
+
+        if (type != RING_PAD) {
+            if (client_fd < 0) {
+                header->dropped++;
+            } else if (!send_message(type, data + off + 4, len)) {
+                break;
+            }
+        }
+
+        tail += step;
+    }
+
+    if (corrupt) {
+        // a broken producer, throw away everything it wrote
+        printf("warn: corrupt ring record, dropping ring contents\r\n");
+        header->dropped++;
+        tail = head;
+    }
+
+    __atomic_store_n(&header->tail, tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,71 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+#include "cli.h"
+
+// message ring DOS programs write into without trapping, for talking to
+// linux at memory speed. it lives in the 64K reserved at 0x100000 by the
+// memmap= on the kernel command line, which is laid out as
+//
+//   0x100000  vm86_init_t, from dsl.com
+//   0x101000  stdio bridge buffer, see bridge.h
+//   0x10d000  ring header, FFFF:D010 to DOS
+//   0x10d010  ring data, RING_SIZE bytes
+//
+// DOS is the only producer and the VMM the only consumer. head and tail are
+// free running byte counts, so head - tail (mod 2^16) is the bytes in use
+// and head & (RING_SIZE - 1) is where the next record goes. DOS only ever
+// writes head, the VMM only tail.
+//
+// each record is a 16 bit payload length and 16 bit type followed by the
+// payload, padded to a multiple of 4 bytes. records do not wrap: when one
+// does not fit before the end of the data, the producer fills the rest with
+// a RING_PAD record and starts again at offset 0.
+//
+// the VMM drains the ring on every vm86 exit, and timer interrupts force one
+// every tick. a producer that finds the ring empty before writing rings the
+// doorbell, INT E7 AH=08h, so the message goes out immediately. see
+// dos/dslring.inc and dos/dslring.h for client code.
+//
+// messages are passed to whichever linux program is connected to
+// RING_SOCKET_PATH, one SOCK_SEQPACKET packet each holding the 16 bit type
+// and payload. while the client is not keeping up the ring is left to fill,
+// pushing back on DOS. with no client connected, messages are dropped and
+// counted in the header.
+
+#define RING_SEG 0xffff
+#define RING_OFF 0xd010
+
+#define RING_MAGIC 0x474e5244 // "DRNG"
+#define RING_SIZE 0x2000
+
+// type of padding records, skipped by the consumer
+#define RING_PAD 0
+
+// largest payload a record can carry
+#define RING_MAX_PAYLOAD (RING_SIZE / 2 - 4)
+
+#define RING_SOCKET_PATH DSL_RUN_DIR "/ring.sock"
+
+typedef struct ring_header {
+    uint32_t magic;
+    uint16_t size;
+    uint16_t head;
+    uint16_t tail;
+    uint16_t dropped;
+    uint32_t reserved;
+}
+__attribute__((packed)) ring_header_t;
+
+// resets the ring, publishes it to DOS and creates the socket
+void
+ring_init();
+
+// passes on whatever DOS has put in the ring. cheap when it is empty, so
+// this is called on every exit
+void
+ring_drain();
+
+#endif
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/loop.h>
+
+#include "cli.h"
+#include "panic.h"
+#include "rootfs.h"
+
+// where things are mounted in the initramfs before switching
+#define LOWER_DIR "/lower"
+#define PERSIST_DIR "/persist"
+#define NEW_ROOT "/newroot"
+
+// the ext4 overlay, kept open to flush it after PERSIST_DIR is left behind
+// in the old root
+static int persist_fd = -1;
+static bool on_disk = false;
+
+// attaches file_fd, opened from path, to a free loop device and mounts it
+// with data as the filesystem options. the loop device clears itself once
+// the mount goes away
+static void
+mount_loop(int file_fd, const char* path, const char* target, const char* fstype,
+    unsigned long flags, const char* data)
+{
+    bool read_only = flags & MS_RDONLY;
+
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0) {
+        fatal("open /dev/loop-control");
+    }
+
+    int num = ioctl(ctl, LOOP_CTL_GET_FREE);
+    if (num < 0) {
+        fatal("LOOP_CTL_GET_FREE");
+    }
+
+    close(ctl);
+
+    char dev[32];
+    snprintf(dev, sizeof(dev), "/dev/loop%d", num);
+
+    int mode = read_only ? O_RDONLY : O_RDWR;
+
+    int loop_fd = open(dev, mode | O_CLOEXEC);
+    if (loop_fd < 0) {
+        fatal("open loop device");
+    }
+
+    if (ioctl(loop_fd, LOOP_SET_FD, file_fd)) {
+        fatal("LOOP_SET_FD");
+    }
+
+    close(file_fd);
+
+    struct loop_info64 info;
+    memset(&info, 0, sizeof(info));
+    info.lo_flags = LO_FLAGS_AUTOCLEAR | (read_only ? LO_FLAGS_READ_ONLY : 0);
+    strncpy((char*)info.lo_file_name, path, LO_NAME_SIZE - 1);
+
+    if (ioctl(loop_fd, LOOP_SET_STATUS64, &info)) {
+        fatal("LOOP_SET_STATUS64");
+    }
+
+    if (mount(dev, target, fstype, flags, data)) {
+        fatal(target);
+    }
+
+    // autoclear would detach it if this were closed before the mount
+    close(loop_fd);
+}
+
+// copies path into memory, returning a file holding it
+static int
+load_image(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fatal(path);
+    }
+
+    int mem_fd = memfd_create(path, MFD_CLOEXEC);
+    if (mem_fd < 0) {
+        fatal("memfd_create");
+    }
+
+    ssize_t copied;
+
+    while ((copied = sendfile(mem_fd, fd, NULL, 1 << 20)) > 0) {
+    }
+
+    if (copied < 0) {
+        fatal(path);
+    }
+
+    close(fd);
+    return mem_fd;
+}
+
+static void
+make_dir(const char* path)
+{
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        fatal(path);
+    }
+}
+
+static void
+move_to(const char* from, const char* to)
+{
+    if (mount(from, to, NULL, MS_MOVE, NULL)) {
+        fatal(to);
+    }
+}
+
+// deletes everything in dir that is on the filesystem dev, not descending
+// into anything mounted over it. takes ownership of dirfd
+static void
+delete_tree(int dirfd, dev_t dev)
+{
+    DIR* dir = fdopendir(dirfd);
+    if (!dir) {
+        close(dirfd);
+        return;
+    }
+
+    struct dirent* ent;
+
+    while ((ent = readdir(dir))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        struct stat st;
+
+        if (fstatat(dirfd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) || st.st_dev != dev) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            int fd = openat(dirfd, ent->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+            if (fd >= 0) {
+                delete_tree(fd, dev);
+            }
+
+            unlinkat(dirfd, ent->d_name, AT_REMOVEDIR);
+        } else {
+            unlinkat(dirfd, ent->d_name, 0);
+        }
+    }
+
+    closedir(dir);
+}
+
+bool
+rootfs_switch()
+{
+    if (access(ROOTFS_IMAGE, R_OK)) {
+        return false;
+    }
+
+    // the loop devices are only there with devtmpfs
+    if (mount("", "/dev", "devtmpfs", 0, NULL)) {
+        fatal("mount devtmpfs");
+    }
+
+    make_dir(LOWER_DIR);
+    make_dir(PERSIST_DIR);
+    make_dir(NEW_ROOT);
+
+    // linux, the control shell on the serial port in particular, can run
+    // programs at any time, including while DOS is using the disk. reading
+    // them from a copy in memory keeps that off the DOS drive
+    mount_loop(load_image(ROOTFS_IMAGE), ROOTFS_IMAGE, LOWER_DIR, "squashfs", MS_RDONLY, NULL);
+
+    if (access(OVERLAY_IMAGE, W_OK) == 0) {
+        int overlay_fd = open(OVERLAY_IMAGE, O_RDWR | O_CLOEXEC);
+        if (overlay_fd < 0) {
+            fatal(OVERLAY_IMAGE);
+        }
+
+        // no lazy inode table zeroing in the background, which would write
+        // to the image whenever ext4 gets round to it. the Makefile has
+        // mke2fs do it up front instead
+        mount_loop(overlay_fd, OVERLAY_IMAGE, PERSIST_DIR, "ext4", MS_NOATIME, "noinit_itable");
+
+        persist_fd = open(PERSIST_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (persist_fd < 0) {
+            fatal("open " PERSIST_DIR);
+        }
+    } else {
+        printf("warn: no " OVERLAY_IMAGE ", changes to / will not persist\r\n");
+
+        if (mount("", PERSIST_DIR, "tmpfs", 0, NULL)) {
+            fatal("mount tmpfs");
+        }
+    }
+
+    make_dir(PERSIST_DIR "/upper");
+    make_dir(PERSIST_DIR "/work");
+
+    const char* options =
+        "lowerdir=" LOWER_DIR ",upperdir=" PERSIST_DIR "/upper,workdir=" PERSIST_DIR "/work";
+
+    if (mount("", NEW_ROOT, "overlay", MS_NOATIME, options)) {
+        fatal("mount overlay");
+    }
+
+    move_to("/proc", NEW_ROOT "/proc");
+    move_to("/mnt/c", NEW_ROOT "/mnt/c");
+    move_to("/dev", NEW_ROOT "/dev");
+
+    // runtime state is rewritten constantly and must not end up on disk
+    if (mount("", NEW_ROOT "/run", "tmpfs", MS_NOSUID | MS_NODEV, "mode=755")) {
+        fatal("mount /run");
+    }
+
+    make_dir(NEW_ROOT DSL_RUN_DIR);
+
+    // free the initramfs, everything still needed is mounted elsewhere
+    struct stat root;
+
+    if (stat("/", &root)) {
+        fatal("stat /");
+    }
+
+    int root_fd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        fatal("open /");
+    }
+
+    delete_tree(root_fd, root.st_dev);
+
+    // and swap the new root in, like switch_root
+    if (chdir(NEW_ROOT)) {
+        fatal("chdir " NEW_ROOT);
+    }
+
+    move_to(".", "/");
+
+    if (chroot(".") || chdir("/")) {
+        fatal("chroot");
+    }
+
+    on_disk = true;
+    return true;
+}
+
+bool
+rootfs_on_disk()
+{
+    return on_disk;
+}
+
+bool
+rootfs_flush()
+{
+    if (persist_fd < 0) {
+        return false;
+    }
+
+    // pushes the ext4 page cache and journal through the loop device into
+    // the image file
+    if (syncfs(persist_fd)) {
+        perror("warn: syncfs " OVERLAY_IMAGE);
+    }
+
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef ROOTFS_H
+#define ROOTFS_H
+
+#include <stdbool.h>
+
+// read-only root filesystem image, built by script/mkrootfs
+#define ROOTFS_IMAGE "/mnt/c/doslinux/rootfs.sqf"
+
+// ext4 image holding the writable overlay on top of it
+#define OVERLAY_IMAGE "/mnt/c/doslinux/overlay.img"
+
+// switches from the initramfs to the persistent root filesystem if the DOS
+// drive has one: ROOTFS_IMAGE mounted read-only through a loop device with
+// OVERLAY_IMAGE (or tmpfs if it is missing) as a writable overlay. /proc,
+// /mnt/c and /dev move across and the initramfs is emptied to free its
+// memory. returns false, leaving the initramfs as root, if there is no image
+bool
+rootfs_switch();
+
+// whether rootfs_switch moved / onto the DOS drive. anything on it that is
+// not already in memory, programs included, is then read from ROOTFS_IMAGE or
+// OVERLAY_IMAGE on demand
+bool
+rootfs_on_disk();
+
+// writes back everything linux has cached for OVERLAY_IMAGE, as far as the
+// DOS drive's own cache: the image is a file on it, so the drive needs
+// syncing after this. false if there is no persistent overlay
+bool
+rootfs_flush();
+
+#endif
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shell.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// the spare reads the directory, command line, stdin and stdout paths and
+// whether to send stderr to stdout from fd 3, one per line
+#define SHELL_FD 3
+
+static const char spare_script[] =
+    "IFS= read -r dir <&3 && IFS= read -r cmd <&3 && "
+    "IFS= read -r in <&3 && IFS= read -r out <&3 && IFS= read -r err <&3 || exit; "
+    "exec 3<&-; "
+    "[ -z \"$in\" ] || exec <\"$in\"; "
+    "[ -z \"$out\" ] || exec >\"$out\"; "
+    "[ -z \"$err\" ] || exec 2>&1; "
+    "[ -z \"$dir\" ] || cd \"$dir\"; "
+    "eval \"$cmd\"";
+
+static pid_t spare_pid = -1;
+static int spare_fd = -1;
+
+static void
+spawn_spare()
+{
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC)) {
+        perror("warn: pipe for spare shell");
+        return;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], SHELL_FD);
+
+    // the VMM blocks everything it takes through signalfd, and the shell
+    // should get SIGPIPE like any other process
+    sigset_t none, pipe_only;
+    sigemptyset(&none);
+    sigemptyset(&pipe_only);
+    sigaddset(&pipe_only, SIGPIPE);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &pipe_only);
+
+    // and leads a process group of its own, so the command and everything it
+    // starts can be stopped together. there is no controlling terminal to
+    // make that a background group
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    char sh[] = "sh";
+    char opt_c[] = "-c";
+    char* argv[] = { sh, opt_c, (char*)spare_script, NULL };
+
+    char path[] = "PATH=/usr/bin:/usr/sbin:/bin:/sbin";
+    char* envp[] = { path, NULL };
+
+    pid_t pid;
+    int rc = posix_spawn(&pid, "/bin/busybox", &actions, &attr, argv, envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+
+    if (rc) {
+        errno = rc;
+        perror("warn: spawn spare shell");
+        close(fds[1]);
+        return;
+    }
+
+    spare_pid = pid;
+    spare_fd = fds[1];
+}
+
+void
+shell_init()
+{
+    // writes to a spare that has died come back as EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+
+    spawn_spare();
+}
+
+// hands the command to the spare, false if it has gone away
+static bool
+hand_over(const char* msg, size_t len)
+{
+    ssize_t written = write(spare_fd, msg, len);
+
+    close(spare_fd);
+    spare_fd = -1;
+
+    if (written == (ssize_t)len) {
+        return true;
+    }
+
+    // killed from the control shell or similar, clean up after it
+    waitpid(spare_pid, NULL, 0);
+    spare_pid = -1;
+    return false;
+}
+
+pid_t
+shell_run(const char* dir, const char* cmdline, const shell_io_t* io)
+{
+    shell_io_t console = { 0 };
+
+    if (!io) {
+        io = &console;
+    }
+
+    // less than PIPE_BUF so it goes in one write
+    char msg[512];
+    int len = snprintf(msg, sizeof(msg), "%s\n%s\n%s\n%s\n%s\n", dir, cmdline,
+        io->in ? io->in : "", io->out ? io->out : "", io->err_to_out ? "1" : "");
+
+    if (len < 0 || (size_t)len >= sizeof(msg)) {
+        fprintf(stderr, "warn: command too long\r\n");
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (spare_pid < 0) {
+            spawn_spare();
+        }
+
+        if (spare_pid < 0) {
+            return -1;
+        }
+
+        pid_t pid = spare_pid;
+
+        if (hand_over(msg, len)) {
+            spare_pid = -1;
+
+            // and get the next one ready while this command runs
+            spawn_spare();
+            return pid;
+        }
+    }
+
+    return -1;
+}
+
+int
+shell_pidfd(pid_t pid)
+{
+    return syscall(SYS_pidfd_open, pid, 0);
+}
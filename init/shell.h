@@ -0,0 +1,36 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// dsl commands are run by a busybox sh started ahead of time and waiting on a
+// pipe, so handing one over only costs a write. the next spare is started
+// while the command runs
+
+// starts the first spare shell
+void
+shell_init();
+
+// where a command's stdio goes instead of the console. paths are opened by
+// the shell, NULL leaves that stream on the console
+typedef struct shell_io {
+    const char* in;
+    const char* out;
+    // stderr follows stdout
+    bool err_to_out;
+}
+shell_io_t;
+
+// has a spare shell cd to dir (if not empty) and run cmdline, returning its
+// pid for the caller to wait on, or -1 if no shell could be started. io may
+// be NULL to run it entirely on the console
+pid_t
+shell_run(const char* dir, const char* cmdline, const shell_io_t* io);
+
+// a pidfd for pid to wait on in poll or the event loop, -1 if the kernel has
+// no pidfd_open
+int
+shell_pidfd(pid_t pid);
+
+#endif
@@ -0,0 +1,90 @@
+#include <cpuid.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "panic.h"
+#include "stats.h"
+
+#define CPUID_TSC (1 << 4)
+
+stats_t* stats;
+
+static bool have_tsc;
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t
+stats_clock()
+{
+    if (have_tsc) {
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return (uint64_t)hi << 32 | lo;
+    }
+
+    return now_ns();
+}
+
+void
+stats_init()
+{
+    // pre-pentium CPUs have no TSC, and the oldest have no cpuid at all,
+    // which __get_cpuid checks for
+    unsigned int eax, ebx, ecx, edx;
+    have_tsc = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & CPUID_TSC);
+
+    int fd = open(STATS_PATH, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        fatal("open " STATS_PATH);
+    }
+
+    if (ftruncate(fd, sizeof(stats_t))) {
+        fatal("ftruncate " STATS_PATH);
+    }
+
+    // pages of the file are only allocated as counters in them are touched,
+    // so the sparse port and INT tables cost little
+    stats = mmap(NULL, sizeof(stats_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (stats == MAP_FAILED) {
+        fatal("mmap " STATS_PATH);
+    }
+
+    close(fd);
+
+    stats->magic = STATS_MAGIC;
+    stats->version = STATS_VERSION;
+    stats->tsc = have_tsc;
+    stats->clock_start = stats->clock_now = stats_clock();
+    stats->clock_start_ns = stats->clock_now_ns = now_ns();
+}
+
+void
+stats_tick()
+{
+    stats->clock_now = stats_clock();
+    stats->clock_now_ns = now_ns();
+}
+
+void
+stats_hist(uint64_t* hist, uint64_t delta)
+{
+    int bucket = delta ? 63 - __builtin_clzll(delta) : 0;
+
+    if (bucket >= STATS_HIST_BUCKETS) {
+        bucket = STATS_HIST_BUCKETS - 1;
+    }
+
+    hist[bucket]++;
+}
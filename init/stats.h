@@ -0,0 +1,88 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cli.h"
+
+// always-on counters the VMM keeps in a shared file under /run/dsl, so that
+// dslstat can read them live without stopping anything. there is a single
+// writer and readers accept the odd torn value
+#define STATS_PATH DSL_RUN_DIR "/stats"
+
+#define STATS_MAGIC 0x53545344
+#define STATS_VERSION 1
+
+// indexed by VM86_TYPE
+#define STATS_EXIT_TYPES 8
+
+// log2 buckets of clock ticks, bucket n counts durations in [2^n, 2^(n+1))
+#define STATS_HIST_BUCKETS 40
+
+typedef struct stats {
+    uint32_t magic;
+    uint32_t version;
+
+    // true if times are in TSC cycles rather than nanoseconds
+    uint32_t tsc;
+    uint32_t pad;
+
+    // clock and CLOCK_MONOTONIC at startup and as of the last timer tick,
+    // for converting cycles to time
+    uint64_t clock_start;
+    uint64_t clock_start_ns;
+    uint64_t clock_now;
+    uint64_t clock_now_ns;
+
+    uint64_t exits[STATS_EXIT_TYPES];
+
+    // time from entering vm86 mode to the next exit, and from the exit to
+    // entering again. supervisor time leaves out time spent idle
+    uint64_t guest_hist[STATS_HIST_BUCKETS];
+    uint64_t supervisor_hist[STATS_HIST_BUCKETS];
+    uint64_t guest_total;
+    uint64_t supervisor_total;
+    uint64_t idle_total;
+
+    uint64_t insn_cache_hits;
+    uint64_t insn_cache_misses;
+
+    // keys dropped because the BIOS buffer was full
+    uint64_t kbd_dropped_keys;
+    // scancodes dropped because DOS was not reading the 8042
+    uint64_t kbd_output_overflows;
+
+    // INT instructions that exited to the supervisor, by vector and AH
+    uint32_t ints[256][256];
+
+    // trapped port accesses, by port and byte/word/dword width
+    uint32_t ports[0x10000][3];
+}
+stats_t;
+
+extern stats_t* stats;
+
+// creates and maps the stats file
+void
+stats_init();
+
+// current time in stats units, TSC cycles if the CPU has one
+uint64_t
+stats_clock();
+
+// refreshes the clock calibration, called on timer ticks
+void
+stats_tick();
+
+void
+stats_hist(uint64_t* hist, uint64_t delta);
+
+static inline void
+stats_port(uint16_t port, uint16_t width)
+{
+    // width 1, 2, 4 to index 0, 1, 2
+    stats->ports[port][width >> 1]++;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "kbd.h"
+#include "pic.h"
+#include "pit.h"
+#include "vm86.h"
+
+typedef struct task {
+    regs_t* regs;
+    kbd_t kbd;
+    pic_t pic;
+    pit_t pit;
+
+    // set by HLT, tells the VMM to idle until the next event
+    bool halted;
+    // true while the VMM is blocked waiting for DOS's next event
+    bool idling;
+}
+task_t;
+
+#endif
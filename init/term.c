@@ -1,4 +1,3 @@
-#include <bits/signal.h>
 #include <fcntl.h>
 #include <linux/kd.h>
 #include <stdint.h>
@@ -56,17 +55,9 @@ term_yield_to_dos()
         fatal("set stdin raw mode");
     }
 
-    // arrange for SIGIO to be raised when input is available
+    // the VMM's event loop reads stdin as it becomes ready
 
-    if (fcntl(STDIN_FILENO, F_SETSIG, SIGIO)) {
-        fatal("set stdin async signal");
-    }
-
-    if (fcntl(STDIN_FILENO, F_SETOWN, getpid())) {
-        fatal("set stdin owner");
-    }
-
-    if (fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK | O_ASYNC)) {
+    if (fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK)) {
         fatal("set stdin nonblock");
     }
 
@@ -86,7 +77,7 @@ term_acquire()
         fatal("set stdin xlate mode");
     }
 
-    // disable O_NONBLOCK and O_ASYNC on terminal
+    // disable O_NONBLOCK on terminal
 
     if (fcntl(STDIN_FILENO, F_SETFL, 0)) {
         fatal("set stdin normal");
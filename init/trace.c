@@ -0,0 +1,76 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "panic.h"
+#include "stats.h"
+#include "trace.h"
+
+trace_ring_t* trace_ring;
+
+static uint32_t
+trace_level_param()
+{
+    const char* level = getenv("dsl_trace");
+
+    if (level == NULL || strcmp(level, "log") == 0) {
+        return TRACE_LOG;
+    } else if (strcmp(level, "off") == 0) {
+        return TRACE_OFF;
+    } else if (strcmp(level, "all") == 0) {
+        return TRACE_ALL;
+    }
+
+    printf("warn: unknown dsl_trace level '%s', using log\r\n", level);
+    return TRACE_LOG;
+}
+
+void
+trace_init()
+{
+    int fd = open(TRACE_PATH, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        fatal("open " TRACE_PATH);
+    }
+
+    if (ftruncate(fd, sizeof(trace_ring_t))) {
+        fatal("ftruncate " TRACE_PATH);
+    }
+
+    trace_ring = mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (trace_ring == MAP_FAILED) {
+        fatal("mmap " TRACE_PATH);
+    }
+
+    close(fd);
+
+    trace_ring->magic = TRACE_MAGIC;
+    trace_ring->version = TRACE_VERSION;
+    trace_ring->entries = TRACE_ENTRIES;
+    trace_ring->level = trace_level_param();
+}
+
+void
+trace_record(int type, regs_t* regs, uint16_t arg, uint8_t width, uint32_t value)
+{
+    uint32_t head = trace_ring->head;
+    trace_entry_t* entry = &trace_ring->ring[head % TRACE_ENTRIES];
+
+    *entry = (trace_entry_t) {
+        .time = stats_clock(),
+        .cs = regs->cs.word.lo,
+        .ip = regs->eip.word.lo,
+        .type = type,
+        .width = width,
+        .arg = arg,
+        .value = value,
+    };
+
+    __atomic_store_n(&trace_ring->head, head + 1, __ATOMIC_RELEASE);
+}
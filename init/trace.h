@@ -0,0 +1,91 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "cli.h"
+#include "vm86.h"
+
+// preallocated ring of binary trace records in a shared file under /run/dsl,
+// written by the VMM without any syscalls and decoded by dsltrace
+#define TRACE_PATH DSL_RUN_DIR "/trace"
+
+#define TRACE_MAGIC 0x43525444
+#define TRACE_VERSION 1
+
+// must be a power of two
+#define TRACE_ENTRIES 16384
+
+// selected with the dsl_trace= kernel parameter, or changed on the fly with
+// dsltrace -l
+enum trace_level {
+    TRACE_OFF,
+    // things that used to be printed: accesses to unclaimed ports and INTs
+    // the supervisor does not know about
+    TRACE_LOG,
+    // every trapped port access, INT exit, IRQ and STI exit
+    TRACE_ALL,
+};
+
+enum trace_type {
+    // arg is the port, value the data
+    TRACE_IN = 1,
+    TRACE_OUT,
+    // arg is the port, value the count
+    TRACE_INS,
+    TRACE_OUTS,
+    // arg is the vector, value AX
+    TRACE_INT,
+    TRACE_INT_UNKNOWN,
+    // arg is the vector
+    TRACE_IRQ,
+    TRACE_STI,
+};
+
+typedef struct trace_entry {
+    // stats_clock units
+    uint64_t time;
+    uint16_t cs;
+    uint16_t ip;
+    uint8_t type;
+    // port access width in bytes
+    uint8_t width;
+    uint16_t arg;
+    uint32_t value;
+    uint32_t pad;
+}
+trace_entry_t;
+
+typedef struct trace_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entries;
+    volatile uint32_t level;
+
+    // number of entries ever written, the next goes at head % entries.
+    // published after the entry is complete
+    uint32_t head;
+    uint32_t pad;
+
+    trace_entry_t ring[TRACE_ENTRIES];
+}
+trace_ring_t;
+
+extern trace_ring_t* trace_ring;
+
+// creates and maps the trace file
+void
+trace_init();
+
+void
+trace_record(int type, regs_t* regs, uint16_t arg, uint8_t width, uint32_t value);
+
+static inline void
+trace(int level, int type, regs_t* regs, uint16_t arg, uint8_t width, uint32_t value)
+{
+    if (trace_ring->level >= (uint32_t)level) {
+        trace_record(type, regs, arg, width, value);
+    }
+}
+
+#endif
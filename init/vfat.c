@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+#include "rootfs.h"
+#include "vfat.h"
+
+static bool
+vfat_writeback_param()
+{
+    const char* mode = getenv("dsl_vfat");
+
+    if (mode == NULL || strcmp(mode, "sync") == 0) {
+        return false;
+    } else if (strcmp(mode, "writeback") == 0) {
+        return true;
+    }
+
+    printf("warn: unknown dsl_vfat mode '%s', using sync\r\n", mode);
+    return false;
+}
+
+static bool
+vfat_writeback()
+{
+    static int writeback = -1;
+
+    if (writeback < 0) {
+        writeback = vfat_writeback_param();
+    }
+
+    return writeback;
+}
+
+unsigned long
+vfat_mount_flags()
+{
+    return vfat_writeback() ? 0 : MS_SYNCHRONOUS;
+}
+
+void
+vfat_flush()
+{
+    static int fd = -1;
+
+    // the persistent overlay is a file on the DOS drive, so its writes land
+    // in the vfat cache and need syncing from there even in sync mode
+    bool overlay = rootfs_flush();
+
+    if (!vfat_writeback() && !overlay) {
+        return;
+    }
+
+    if (fd < 0) {
+        fd = open(VFAT_MOUNT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd < 0) {
+            perror("warn: open " VFAT_MOUNT);
+            return;
+        }
+    }
+
+    if (syncfs(fd)) {
+        perror("warn: syncfs " VFAT_MOUNT);
+    }
+}
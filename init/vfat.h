@@ -0,0 +1,19 @@
+#ifndef VFAT_H
+#define VFAT_H
+
+// the DOS drive once it is mounted for linux
+#define VFAT_MOUNT "/mnt/c"
+
+// mount flags for the DOS drive. normally writes are synchronous so DOS sees
+// them immediately, with dsl_vfat=writeback linux caches them and they are
+// flushed by vfat_flush whenever control goes back to DOS
+unsigned long
+vfat_mount_flags();
+
+// writes back anything linux has cached for the DOS drive and waits for it,
+// before DOS gets the machine back. that includes the persistent overlay
+// image, see rootfs_flush. does nothing in sync mode without one
+void
+vfat_flush();
+
+#endif
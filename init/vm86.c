@@ -1,76 +1,40 @@
 #include <bits/signal.h>
 #include <bits/syscall.h>
 #include <errno.h>
-#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/io.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "bridge.h"
+#include "event.h"
+#include "insn.h"
+#include "jobs.h"
 #include "kbd.h"
+#include "keys.h"
+#include "mem.h"
 #include "panic.h"
+#include "pic.h"
+#include "pit.h"
+#include "port.h"
+#include "profile.h"
+#include "redir.h"
+#include "ring.h"
+#include "shell.h"
+#include "stats.h"
+#include "task.h"
 #include "term.h"
+#include "trace.h"
+#include "vfat.h"
 #include "vm86.h"
 
-typedef struct task {
-    regs_t* regs;
-    kbd_t kbd;
-    bool pending_interrupt;
-    uint8_t pending_interrupt_nr;
-}
-task_t;
-
-enum rep_kind {
-    NONE,
-    REP,
-};
-
-enum bit_size {
-    BITS16 = 0,
-    BITS32 = 1,
-};
-
-static void*
-linear(uint16_t segment, uint16_t offset)
-{
-    uint32_t seg32 = segment;
-    uint32_t off32 = offset;
-    uint32_t lin = (seg32 << 4) + off32;
-    return (void*)lin;
-}
-
-static uint8_t
-peek8(uint16_t segment, uint16_t offset)
-{
-    return *(uint8_t*)linear(segment, offset);
-}
-
-static void
-poke8(uint16_t segment, uint16_t offset, uint8_t value)
-{
-    *(uint8_t*)linear(segment, offset) = value;
-}
-
-static void
-poke16(uint16_t segment, uint16_t offset, uint16_t value)
-{
-    *(uint16_t*)linear(segment, offset) = value;
-}
-
-static void
-poke32(uint16_t segment, uint16_t offset, uint32_t value)
-{
-    *(uint32_t*)linear(segment, offset) = value;
-}
-
-static uint8_t
-peekip(regs_t* regs, uint16_t offset)
-{
-    return peek8(regs->cs.word.lo, regs->eip.word.lo + offset);
-}
+// scancodes read from the console per read() call
+#define KBD_STAGING_SIZE 256
 
 struct ivt_descr {
     uint16_t offset;
@@ -86,17 +50,27 @@ push16(regs_t* regs, uint16_t value)
     poke16(regs->ss.word.lo, regs->esp.word.lo, value);
 }
 
-static void do_pending_int(task_t* task);
-
 static void
 do_int(task_t* task, uint8_t vector)
 {
-    push16(task->regs, task->regs->eflags.word.lo);
-    push16(task->regs, task->regs->cs.word.lo);
-    push16(task->regs, task->regs->eip.word.lo);
+    regs_t* regs = task->regs;
+
+    // the kernel tracks DOS's interrupt flag in VIF, while IF in the flags it
+    // hands us is the real one. push the virtual one so IRET restores it
+    uint16_t flags = regs->eflags.word.lo & ~FLAG_INTERRUPT;
+
+    if (regs->eflags.dword & FLAG_VIF) {
+        flags |= FLAG_INTERRUPT;
+    }
+
+    push16(regs, flags);
+    push16(regs, regs->cs.word.lo);
+    push16(regs, regs->eip.word.lo);
+    regs->eflags.dword &= ~(FLAG_VIF | FLAG_TRAP);
+
     struct ivt_descr* descr = &IVT[vector];
-    task->regs->cs.word.lo = descr->segment;
-    task->regs->eip.dword = descr->offset;
+    regs->cs.word.lo = descr->segment;
+    regs->eip.dword = descr->offset;
 }
 
 static void
@@ -105,365 +79,167 @@ do_software_int(task_t* task, uint8_t vector)
     do_int(task, vector);
 }
 
-static void
-do_pending_int(task_t* task)
+// true if an interrupt vector still points at the BIOS rather than at a
+// handler installed by DOS or a DOS program
+static bool
+is_bios_vector(uint8_t vector)
 {
-    if (task->pending_interrupt) {
-        task->pending_interrupt = false;
-        do_int(task, task->pending_interrupt_nr);
-    }
+    return IVT[vector].segment >= 0xf000;
 }
 
-static bool
-is_port_whitelisted(uint16_t port)
+// raises device IRQs on the virtual PIC and delivers the highest priority
+// pending one to DOS, called before every return to DOS
+static void
+deliver_irqs(task_t* task)
 {
-    // ports whitelisted here are directly accessed by DOS rather than through
-    // BIOS. we need to do something about them eventually, but for now just
-    // let access succeed without intervention.
-
-    // programmable interrupt controller
-    if (port == 0x20 || port == 0x21 || port == 0xa0 || port == 0xa1) {
-        return true;
-    }
-
-    // programmable interval timer
-    if (port >= 0x40 && port <= 0x43) {
-        // TODO should we handle timing ourselves? it might mess with linux
-        return true;
-    }
-
-    // primary ATA
-    if (port >= 0x1f0 && port <= 0x1f7) {
-        return true;
-    }
-
-    // secondary ATA
-    if (port >= 0x170 && port <= 0x177) {
-        return true;
-    }
+    regs_t* regs = task->regs;
 
-    // VGA
-    if (port >= 0x3b0 && port <= 0x3df) {
-        return true;
-    }
-
-    // floppy disk
-    if (port >= 0x3f0 && port <= 0x3f7) {
-        return true;
-    }
-
-    // dunno what these are
-    if (port >= 0x1ce && port <= 0x1cf) {
-        return true;
-    }
+    pit_raise_irqs(&task->pit, &task->pic);
 
-    if (port == 0x402) {
-        return true;
-    }
+    // kbd.c stands in for the BIOS keyboard handler and has already put the
+    // key in its buffer, so IRQ 1 only needs raising for DOS programs that
+    // hook it themselves. they read the scancode from the emulated 8042,
+    // which is emptied otherwise
+    uint8_t kbd_vector = pic_irq_vector(&task->pic, KBD_IRQ);
 
-    if (port == 0x608) {
-        return true;
+    if (is_bios_vector(kbd_vector)) {
+        kbd_discard_output(&task->kbd);
+    } else if (kbd_has_output(&task->kbd) && !pic_irq_busy(&task->pic, KBD_IRQ)) {
+        pic_raise_irq(&task->pic, KBD_IRQ);
     }
 
-    return false;
-}
-
-static uint8_t
-do_inb(task_t* task, uint16_t port)
-{
-    uint8_t value = inb(port);
+    regs->eflags.dword &= ~FLAG_VIP;
 
-    if (!is_port_whitelisted(port)) {
-        printf("inb port %04x value %02x cs:ip %04x:%04x\r\n",
-            port, value, task->regs->cs.word.lo, task->regs->eip.word.lo);
+    if (!pic_has_pending(&task->pic)) {
+        return;
     }
 
-    return value;
-}
-
-static uint16_t
-do_inw(task_t* task, uint16_t port)
-{
-    uint16_t value = inw(port);
-
-    if (!is_port_whitelisted(port)) {
-        printf("inw port %04x value %04x cs:ip %04x:%04x\r\n",
-            port, value, task->regs->cs.word.lo, task->regs->eip.word.lo);
+    if (regs->eflags.dword & FLAG_VIF) {
+        uint8_t vector = pic_acknowledge(&task->pic);
+        trace(TRACE_ALL, TRACE_IRQ, regs, vector, 0, 0);
+        do_int(task, vector);
+    } else {
+        // have the kernel return VM86_STI as soon as DOS enables interrupts
+        regs->eflags.dword |= FLAG_VIP;
     }
-
-    return value;
 }
 
-static uint32_t
-do_ind(task_t* task, uint16_t port)
+static void
+setup_ports()
 {
-    uint32_t value = inl(port);
-
-    if (!is_port_whitelisted(port)) {
-        printf("ind port %04x value %08x cs:ip %04x:%04x\r\n",
-            port, value, task->regs->cs.word.lo, task->regs->eip.word.lo);
-    }
+    // ports registered here are directly accessed by DOS rather than through
+    // BIOS. we need to do something about them eventually, but for now just
+    // let access succeed without intervention. everything else is logged,
+    // apart from ports owned by the emulated devices.
 
-    return value;
-}
+    // primary ATA
+    port_register(0x1f0, 0x1f7, &port_passthrough);
 
-static void
-do_outb(task_t* task, uint16_t port, uint8_t value)
-{
-    if (port == 0x20) {
-        // ignore pic writes, they mess with stuff
-        return;
-    }
+    // secondary ATA
+    port_register(0x170, 0x177, &port_passthrough);
 
-    if (!is_port_whitelisted(port)) {
-        printf("outb port %04x value %02x cs:ip %04x:%04x\r\n",
-            port, value, task->regs->cs.word.lo, task->regs->eip.word.lo);
-    }
+    // VGA
+    port_register(0x3b0, 0x3df, &port_passthrough);
 
-    outb(value, port);
-}
+    // floppy disk
+    port_register(0x3f0, 0x3f7, &port_passthrough);
 
-static void
-do_outw(task_t* task, uint16_t port, uint16_t value)
-{
-    if (!is_port_whitelisted(port)) {
-        printf("outw port %04x value %04x cs:ip %04x:%04x\r\n",
-            port, value, task->regs->cs.word.lo, task->regs->eip.word.lo);
-    }
+    // dunno what these are
+    port_register(0x1ce, 0x1cf, &port_passthrough);
+    port_register(0x402, 0x402, &port_passthrough);
+    port_register(0x608, 0x608, &port_passthrough);
 
-    outw(value, port);
+    port_grant();
 }
 
-static void
-do_outd(task_t* task, uint16_t port, uint32_t value)
+void
+vm86_gpf(task_t* task)
 {
-    if (!is_port_whitelisted(port)) {
-        printf("outd port %04x value %08x cs:ip %04x:%04x\r\n",
-            port, value, task->regs->cs.word.lo, task->regs->eip.word.lo);
-    }
+    emulate_insn(task);
 
-    outl(value, port);
+    // FIXME something is setting NT, IOPL=3, and a reserved bit in EFLAGS
+    // not sure what's happening, but this causes things to break and clearing
+    // these bits seems to work around it for now ¯\_(ツ)_/¯
+    task->regs->eflags.dword &= ~(0xf << 12);
 }
 
+// pulls the command out of the calling program's PSP, and works out the linux
+// directory for the current DOS drive in DL and path at DS:SI unless
+// linux_dir is NULL
 static void
-do_insb(task_t* task)
+read_command(task_t* task, char cmdline[256], char linux_dir[70])
 {
-    poke8(task->regs->es16.word.lo, task->regs->edi.word.lo, do_inb(task, task->regs->edx.word.lo));
-    task->regs->edi.word.lo += 1;
-}
+    uint32_t prog_base = (uint32_t)task->regs->cs.word.lo << 4;
 
-static void
-do_insw(task_t* task)
-{
-    uint16_t value = do_inw(task, task->regs->edx.word.lo);
-    poke16(task->regs->es16.word.lo, task->regs->edi.word.lo, value);
-    task->regs->edi.word.lo += 2;
-}
+    // extract command to execute out of PSP
+    uint8_t* psp = (uint8_t*)prog_base;
+    size_t cmdline_len = psp[0x80];
+    uint8_t* cmdline_raw = psp + 0x81;
 
-static void
-do_insd(task_t* task)
-{
-    uint32_t value = do_ind(task, task->regs->edx.word.lo);
-    poke32(task->regs->es16.word.lo, task->regs->edi.word.lo, value);
-    task->regs->edi.word.lo += 4;
-}
+    memset(cmdline, 0, 256);
+    memcpy(cmdline, cmdline_raw, cmdline_len);
 
-static uint32_t
-rep_count(regs_t* regs, enum rep_kind rep_kind, enum bit_size operand, enum bit_size address)
-{
-    if (rep_kind == NONE) {
-        return 1;
-    } else {
-        if (operand ^ address) {
-            return regs->ecx.dword;
-        } else {
-            return regs->ecx.word.lo;
-        }
+    if (!linux_dir) {
+        return;
     }
-}
 
-static void
-emulate_insn(task_t* task)
-{
-    enum bit_size address = BITS16;
-    enum bit_size operand = BITS16;
-    enum rep_kind rep_kind = NONE;
-
-prefix:
-    switch (peekip(task->regs, 0)) {
-        case 0x66:
-            operand = BITS32;
-            task->regs->eip.word.lo++;
-            goto prefix;
-        case 0x67:
-            address = BITS32;
-            task->regs->eip.word.lo++;
-            goto prefix;
-        case 0xf3:
-            rep_kind = REP;
-            task->regs->eip.word.lo++;
-            goto prefix;
-
-        // segment overrides, just ignore:
-        case 0x2e: // cs
-        case 0x3e: // ds
-        case 0x26: // es
-        case 0x36: // ss
-        case 0x64: // fs
-        case 0x65: // gs
-            goto prefix;
-
-        default:
-            break;
-    }
+    // extract current DOS drive from DL and path from SI, the shell
+    // changes to the matching linux directory
+    linux_dir[0] = 0;
+    char current_dos_drive = task->regs->edx.byte.lo;
 
-#define REPEAT(blk) do { \
-        for (uint32_t count = rep_count(task->regs, rep_kind, operand, address); count; count--) { \
-            blk \
-        } \
-        if (rep_kind != NONE) { \
-            task->regs->ecx.dword = 0; \
-        } \
-    } while (0)
+    if (current_dos_drive >= 'a' && current_dos_drive <= 'z') {
+        const char* current_dos_path = linear(task->regs->cs.word.lo, task->regs->esi.word.lo);
 
-    switch (peekip(task->regs, 0)) {
-    case 0x6c: {
-        // INSB
+        strcpy(linux_dir, "/mnt/");
+        char* linux_dir_ptr = linux_dir + 5;
 
-        REPEAT({
-            do_insb(task);
-        });
+        *linux_dir_ptr++ = current_dos_drive;
+        *linux_dir_ptr++ = '/';
 
-        task->regs->eip.word.lo += 1;
-        return;
-    }
-    case 0x6d: {
-        // INSW
+        for (size_t i = 0; i < 64; i++) {
+            if (current_dos_path[i] == 0) {
+                break;
+            }
 
-        REPEAT({
-            if (operand == BITS32) {
-                do_insd(task);
+            if (current_dos_path[i] == '\\') {
+                *linux_dir_ptr++ = '/';
             } else {
-                do_insw(task);
+                *linux_dir_ptr++ = current_dos_path[i];
             }
-        });
-
-        task->regs->eip.word.lo += 1;
-        return;
-    }
-    case 0xe4:
-        // INB imm
-        task->regs->eax.byte.lo = do_inb(task, peekip(task->regs, 1));
-        task->regs->eip.word.lo += 2;
-        return;
-    case 0xe5:
-        // INW imm
-        if (operand == BITS32) {
-            task->regs->eax.dword = do_ind(task, peekip(task->regs, 1));
-        } else {
-            task->regs->eax.word.lo = do_inw(task, peekip(task->regs, 1));
-        }
-        task->regs->eip.word.lo += 2;
-        return;
-    case 0xe6:
-        // OUTB imm
-        do_outb(task, peekip(task->regs, 1), task->regs->eax.byte.lo);
-        task->regs->eip.word.lo += 2;
-        return;
-    case 0xe7:
-        // OUTW imm
-        if (operand == BITS32) {
-            do_outd(task, peekip(task->regs, 1), task->regs->eax.dword);
-        } else {
-            do_outw(task, peekip(task->regs, 1), task->regs->eax.word.lo);
-        }
-        task->regs->eip.word.lo += 2;
-        return;
-    case 0xec:
-        // INB DX
-        task->regs->eax.byte.lo = do_inb(task, task->regs->edx.word.lo);
-        task->regs->eip.word.lo += 1;
-        return;
-    case 0xed:
-        // INW DX
-        if (operand == BITS32) {
-            task->regs->eax.dword = do_ind(task, task->regs->edx.word.lo);
-        } else {
-            task->regs->eax.word.lo = do_inw(task, task->regs->edx.word.lo);
         }
-        task->regs->eip.word.lo += 1;
-        return;
-    case 0xee:
-        // OUTB DX
-        do_outb(task, task->regs->edx.word.lo, task->regs->eax.byte.lo);
-        task->regs->eip.word.lo += 1;
-        return;
-    case 0xef:
-        // OUTW DX
-        if (operand == BITS32) {
-            do_outd(task, task->regs->edx.word.lo, task->regs->eax.dword);
-        } else {
-            do_outw(task, task->regs->edx.word.lo, task->regs->eax.word.lo);
-        }
-        task->regs->eip.word.lo += 1;
-        return;
-    case 0xf4: {
-        // HLT
-
-        if (!(task->regs->eflags.word.lo & FLAG_INTERRUPT)) {
-            panic("8086 task halted CPU with interrupts disabled");
-        }
-
-        // just no-op on HLT for now
-
-        task->regs->eip.word.lo += 1;
 
-        return;
-    }
-    default:
-        printf("[%04x:%04x] unknown instruction in gpf: %02x\n",
-            task->regs->cs.word.lo,
-            task->regs->eip.word.lo,
-            peekip(task->regs, 0));
-        halt();
+        *linux_dir_ptr++ = 0;
     }
-
-    panic("unhandled GPF");
 }
 
-void
-vm86_interrupt(task_t* task, uint8_t vector)
+// waits for the next thing the bridged command needs DOS to do, giving the
+// console back to DOS once it is done
+static void
+next_bridge_request(regs_t* regs)
 {
-    if (task->regs->eflags.word.lo & FLAG_INTERRUPT) {
-        // printf("Dispatching interrupt %04x\r\n", vector);
-        do_int(task, vector);
-    } else {
-        printf("Setting pending interrupt %04x\r\n", vector);
-        task->pending_interrupt = true;
-        task->pending_interrupt_nr = vector;
-    }
-}
+    bridge_next(&regs->eax.word.lo, &regs->ecx.word.lo);
 
-void
-vm86_gpf(task_t* task)
-{
-    emulate_insn(task);
+    // DOS is about to do file I/O, and the command is stopped until it is
+    // done, so anything it wrote has to be on the disk now
+    vfat_flush();
 
-    // FIXME something is setting NT, IOPL=3, and a reserved bit in EFLAGS
-    // not sure what's happening, but this causes things to break and clearing
-    // these bits seems to work around it for now ¯\_(ツ)_/¯
-    task->regs->eflags.dword &= ~(0xf << 12);
+    if (regs->eax.word.lo == BRIDGE_DONE) {
+        event_modify(STDIN_FILENO, EPOLLIN);
+        term_yield_to_dos();
+    }
 }
 
 static void
 do_syscall(task_t* task)
 {
     uint8_t ah = task->regs->eax.byte.hi;
+    regs_t* regs = task->regs;
 
     switch (ah) {
         case 0: {
             // presence test
-            task->regs->eax.word.lo = 1;
+            regs->eax.word.lo = 1;
             break;
         }
         case 1: {
@@ -472,84 +248,131 @@ do_syscall(task_t* task)
             // first acquire ownership of the terminal
             term_acquire();
 
-            uint32_t prog_base = (uint32_t)task->regs->cs.word.lo << 4;
-
-            // extract command to execute out of PSP
-            uint8_t* psp = (uint8_t*)prog_base;
-            size_t cmdline_len = psp[0x80];
-            uint8_t* cmdline_raw = psp + 0x81;
-
-            char cmdline[256] = { 0 };
-            memcpy(cmdline, cmdline_raw, cmdline_len);
+            char cmdline[256];
+            char linux_dir[70];
+            read_command(task, cmdline, linux_dir);
 
-            // extract current DOS drive from DL and path from SI
-            char current_dos_drive = task->regs->edx.byte.lo;
-
-            if (current_dos_drive >= 'a' && current_dos_drive <= 'z') {
-                const char* current_dos_path = linear(task->regs->cs.word.lo, task->regs->esi.word.lo);
-
-                char linux_dir[70] = "/mnt/";
-                char* linux_dir_ptr = linux_dir + 5;
+            // execute the command
+            pid_t child = shell_run(linux_dir, cmdline, NULL);
 
-                *linux_dir_ptr++ = current_dos_drive;
-                *linux_dir_ptr++ = '/';
+            while (child >= 0) {
+                int wstat;
+                int rc = waitpid(child, &wstat, 0);
 
-                for (size_t i = 0; i < 64; i++) {
-                    if (current_dos_path[i] == 0) {
-                        break;
-                    }
+                if (rc < 0) {
+                    perror("waitpid");
+                    break;
+                }
 
-                    if (current_dos_path[i] == '\\') {
-                        *linux_dir_ptr++ = '/';
-                    } else {
-                        *linux_dir_ptr++ = current_dos_path[i];
-                    }
+                if (WIFEXITED(wstat) || WIFSIGNALED(wstat)) {
+                    break;
                 }
+            }
 
-                *linux_dir_ptr++ = 0;
+            // DOS must see everything the command wrote before it runs again
+            vfat_flush();
 
-                int rc = chdir(linux_dir);
+            // yield terminal ownership back to DOS
+            term_yield_to_dos();
+            break;
+        }
+        case 2: {
+            // run command in the background, job id in AX or 0 on failure.
+            // DOS keeps the terminal, and the disk, so the job starts off the
+            // DOS drive in JOBS_DIR
+            char cmdline[256];
+            read_command(task, cmdline, NULL);
+
+            regs->eax.word.lo = jobs_start(cmdline);
+            break;
+        }
+        case 3: {
+            // job status: BX job id. AX is 0 running, 1 exited with the exit
+            // status in CX, or ffff if there is no such job
+            uint16_t state, code;
+
+            if (jobs_status(regs->ebx.word.lo, &state, &code)) {
+                regs->eax.word.lo = state;
+                regs->ecx.word.lo = code;
+            } else {
+                regs->eax.word.lo = 0xffff;
+            }
 
-                if (rc < 0) {
-                    perror("warn: cannot chdir");
-                }
+            break;
+        }
+        case 4: {
+            // wait for job BX, or any job if 0, and forget it. AX is 0 with
+            // the job in BX and exit status in CX, or ffff if there is no
+            // such job
+            uint16_t id = regs->ebx.word.lo, code;
+
+            if (jobs_wait(&id, &code)) {
+                regs->eax.word.lo = 0;
+                regs->ebx.word.lo = id;
+                regs->ecx.word.lo = code;
+            } else {
+                regs->eax.word.lo = 0xffff;
             }
 
-            // execute the command
-            pid_t child = fork();
+            // it may have written to the DOS drive
+            vfat_flush();
+            break;
+        }
+        case 5: {
+            // list jobs: up to CX job_info_t entries into ES:DI, count in AX
+            uint16_t max = regs->ecx.word.lo;
 
-            if (child < 0) {
-                perror("fork");
-                break;
+            if (max > JOB_MAX) {
+                max = JOB_MAX;
             }
 
-            if (child == 0) {
-                char sh[] = "sh";
-                char opt_c[] = "-c";
-                char* argv[] = { sh, opt_c, cmdline, NULL };
+            job_info_t infos[JOB_MAX];
+            uint16_t count = jobs_list(infos, max);
 
-                char path[] = "PATH=/usr/bin:/usr/sbin:/bin:/sbin";
-                char* envp[] = { path, NULL };
+            memcpy(linear(regs->es16.word.lo, regs->edi.word.lo), infos, count * sizeof(job_info_t));
+            regs->eax.word.lo = count;
+            break;
+        }
+        case 6: {
+            // run command with DOS stdin (BL bit 0) and/or stdout (BL bit 1)
+            // bridged to it. returns the first bridge request in AX and CX,
+            // see bridge.h
+            char cmdline[256];
+            char linux_dir[70];
+            read_command(task, cmdline, linux_dir);
 
-                execve("/bin/busybox", argv, envp);
-            }
+            uint8_t flags = regs->ebx.byte.lo;
 
-            while (1) {
-                int wstat;
-                int rc = waitpid(child, &wstat, 0);
+            term_acquire();
 
-                if (rc < 0) {
-                    perror("waitpid");
-                    break;
-                }
+            // the command reads the console itself, keep the VMM off it
+            // while DOS runs in between requests
+            event_modify(STDIN_FILENO, 0);
 
-                if (WIFEXITED(wstat)) {
-                    break;
-                }
+            if (!bridge_start(linux_dir, cmdline, flags & 1, flags & 2)) {
+                regs->eax.word.lo = BRIDGE_DONE;
+                regs->ecx.word.lo = 0xff;
+                event_modify(STDIN_FILENO, EPOLLIN);
+                vfat_flush();
+                term_yield_to_dos();
+                break;
             }
 
-            // yield terminal ownership back to DOS
-            term_yield_to_dos();
+            next_bridge_request(regs);
+            break;
+        }
+        case 7: {
+            // result of the last bridge request in CX, next request in AX and
+            // CX
+            bridge_result(regs->ecx.word.lo);
+            next_bridge_request(regs);
+            break;
+        }
+        case 8: {
+            // ring doorbell, DOS has put messages in an empty ring. the drain
+            // after every exit picks them up
+            ring_drain();
+            break;
         }
         default: {
             break;
@@ -557,32 +380,73 @@ do_syscall(task_t* task)
     }
 }
 
-static volatile sig_atomic_t
-received_keyboard_input = 0;
-
+// drains stdin in batches, run from the event loop
 static void
-on_sigio(int sig, siginfo_t* info, void* context)
+read_keyboard(void* ctx, uint32_t events)
 {
-    (void)sig;
-    (void)context;
+    task_t* task = ctx;
+    (void)events;
 
-    if (info->si_fd == STDIN_FILENO && (info->si_band & POLLIN)) {
-        // data to be read on stdin
-        received_keyboard_input = 1;
+    while (1) {
+        uint8_t scancodes[KBD_STAGING_SIZE];
+        ssize_t nread = read(STDIN_FILENO, scancodes, sizeof(scancodes));
+
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (nread <= 0) {
+            // EAGAIN once drained. eof? what to do...
+            break;
+        }
+
+        kbd_send_input_bulk(&task->kbd, scancodes, nread);
+
+        if ((size_t)nread < sizeof(scancodes)) {
+            break;
+        }
     }
 }
 
+// time spent in idle since the last vm86 exit, which is not counted as
+// supervisor time
+static uint64_t idle_since_exit;
+
+// sleeps until there is keyboard input or a timer tick, for when DOS has
+// nothing to do until its next interrupt (HLT, APM idle, waiting for a key)
 static void
-setup_sigio()
+idle(task_t* task)
 {
-    struct sigaction sa = { 0 };
-    sa.sa_sigaction = on_sigio;
-    sa.sa_flags = SA_SIGINFO;
-    sigemptyset(&sa.sa_mask);
+    // only an interrupt DOS can take right now ends the wait early. a tick
+    // held off by a masked or in service IRQ 0, or by DOS having interrupts
+    // off, has to wait for something else to happen first
+    pit_raise_irqs(&task->pit, &task->pic);
 
-    if (sigaction(SIGIO, &sa, NULL)) {
-        fatal("sigaction SIGIO");
+    if ((task->regs->eflags.dword & FLAG_VIF) && pic_has_pending(&task->pic)) {
+        return;
     }
+
+    uint64_t start = stats_clock();
+    task->idling = true;
+    event_dispatch(-1);
+    task->idling = false;
+    uint64_t elapsed = stats_clock() - start;
+
+    stats->idle_total += elapsed;
+    idle_since_exit += elapsed;
+}
+
+// hands the console back to linux so the machine is still usable after the
+// VMM is killed from the control shell
+static void
+on_sigterm(void* ctx, int signo)
+{
+    (void)ctx;
+    (void)signo;
+
+    term_acquire();
+    printf("doslinux: vmm terminated\r\n");
+    exit(0);
 }
 
 __attribute__((noreturn)) void
@@ -609,51 +473,83 @@ vm86_run(struct vm86_init init_params)
 
     task_t task = { 0 };
     task.regs = (void*)&vm86.regs;
-    kbd_init(&task.kbd);
 
-    setup_sigio();
+    stats_init();
+    trace_init();
+    event_init();
+    profile_init(&task, init_params.first_mcb);
+    shell_init();
+    jobs_init();
+    ring_init();
+
+    if (redir_init(&init_params)) {
+        // DOS passes file calls on the linux drive to INT 2Fh
+        vm86.int_revectored.__map[0x2f >> 5] |= 1 << (0x2f & 0x1f);
+    }
+
+    port_init();
+    pic_init(&task.pic);
+    pit_init(&task.pit);
+    kbd_init(&task.kbd);
+    setup_ports();
     term_init();
+    vfat_flush();
     term_yield_to_dos();
 
+    event_add(STDIN_FILENO, EPOLLIN, read_keyboard, &task);
+    keys_init(&task.kbd);
+    event_add_signal(SIGTERM, on_sigterm, NULL);
+
+    uint64_t exit_clock = stats_clock();
+
     while (1) {
-        // set IOPL=0 before returning to DOS so we can intercept port I/O
+        deliver_irqs(&task);
+
+        if (!event_enter_guest()) {
+            // something came in since the last exit, handle it and go round
+            // again to deliver whatever interrupts it raised
+            event_dispatch(0);
+            continue;
+        }
+
+        // set IOPL=0 before returning to DOS so we can intercept port I/O,
+        // other than the passthrough ports granted in port.c
         iopl(0);
 
+        uint64_t enter_clock = stats_clock();
+        uint64_t supervisor = enter_clock - exit_clock - idle_since_exit;
+        stats_hist(stats->supervisor_hist, supervisor);
+        stats->supervisor_total += supervisor;
+        idle_since_exit = 0;
+
         int rc = syscall(SYS_vm86, VM86_ENTER, &vm86);
 
+        exit_clock = stats_clock();
+        stats_hist(stats->guest_hist, exit_clock - enter_clock);
+        stats->guest_total += exit_clock - enter_clock;
+        stats->exits[VM86_TYPE(rc) % STATS_EXIT_TYPES]++;
+
         // and then reenable it for the supervisor
         iopl(3);
 
-        switch (VM86_TYPE(rc)) {
-            case VM86_SIGNAL: {
-                if (received_keyboard_input) {
-                    // even if we race with a second signal here, we should
-                    // always catch the input in the read call anyway
-                    received_keyboard_input = 0;
+        event_leave_guest();
 
-                    while (1) {
-                        char scancode;
-                        ssize_t nread = read(STDIN_FILENO, &scancode, 1);
+        // DOS writes the ring without trapping, so check it on every exit
+        ring_drain();
 
-                        if (nread < 0 && errno == EAGAIN) {
-                            break;
-                        }
-
-                        if (nread == 0) {
-                            // eof? what to do...
-                            break;
-                        }
-
-                        kbd_send_input(&task.kbd, scancode);
-
-                        // IRQ #1 is ivec 9 - TODO handle PIC remapping
-                        // vm86_interrupt(&task, 0x09);
-                    }
-                }
+        switch (VM86_TYPE(rc)) {
+            case VM86_SIGNAL: {
+                // kicked by the event thread, events are dispatched at the
+                // top of the loop
                 break;
             }
             case VM86_UNKNOWN: {
                 vm86_gpf(&task);
+
+                if (task.halted) {
+                    task.halted = false;
+                    idle(&task);
+                }
                 break;
             }
             case VM86_INTx: {
@@ -661,15 +557,33 @@ vm86_run(struct vm86_init init_params)
                 uint8_t ah = task.regs->eax.byte.hi;
                 uint16_t ax = task.regs->eax.word.lo;
 
+                stats->ints[vector][ah]++;
+                trace(TRACE_ALL, TRACE_INT, task.regs, vector, 0, ax);
+
                 if (vector == 0xe7) {
                     // doslinux syscall
                     do_syscall(&task);
                     break;
                 }
 
+                if (vector == 0x2f) {
+                    // network redirector, for the linux drive. everything
+                    // else goes to DOS
+                    if (!redir_int(task.regs)) {
+                        do_software_int(&task, vector);
+                    }
+                    break;
+                }
+
                 if (vector == 0x16) {
                     // BIOS keyboard services
-                    kbd_int(&task.kbd, task.regs);
+                    if (!kbd_int(&task.kbd, task.regs)) {
+                        // waiting for a key. back up to re-execute the INT
+                        // instruction and idle until there is input, so that
+                        // timer interrupts still reach DOS meanwhile
+                        task.regs->eip.word.lo -= 2;
+                        idle(&task);
+                    }
                     break;
                 }
 
@@ -681,6 +595,7 @@ vm86_run(struct vm86_init init_params)
 
                 if (vector == 0x15 && ax == 0x5305) {
                     // APM cpu idle
+                    idle(&task);
                     break;
                 }
 
@@ -697,15 +612,15 @@ vm86_run(struct vm86_init init_params)
                 }
 
                 // log all non-whitelisted software interrupts
-                printf("VM86_INTx: %02x AX=%04x CS:IP=%04x:%04x\r\n",
-                    VM86_ARG(rc), task.regs->eax.word.lo, task.regs->cs.word.lo, task.regs->eip.word.lo);
+                trace(TRACE_LOG, TRACE_INT_UNKNOWN, task.regs, vector, 0, ax);
 
                 do_software_int(&task, VM86_ARG(rc));
                 break;
             }
             case VM86_STI: {
-                printf("VM86_STI\r\n");
-                do_pending_int(&task);
+                // DOS enabled interrupts with an IRQ pending, it is
+                // delivered by deliver_irqs on the way back in
+                trace(TRACE_ALL, TRACE_STI, task.regs, 0, 0, 0);
                 break;
             }
             case VM86_PICRETURN: {
@@ -7,9 +7,14 @@
 
 #define DOSLINUX_INT 0xe7
 
+#define FLAG_CARRY                  (1 << 0)
 #define FLAG_ZERO                   (1 << 6)
+#define FLAG_TRAP                   (1 << 8)
 #define FLAG_INTERRUPT              (1 << 9)
+#define FLAG_DIRECTION              (1 << 10)
 #define FLAG_VM8086                 (1 << 17)
+#define FLAG_VIF                    (1 << 19)
+#define FLAG_VIP                    (1 << 20)
 
 typedef union reg32 {
     uint32_t dword;
@@ -59,6 +64,15 @@ typedef struct vm86_init {
     uint16_t flags;
     uint16_t sp;
     uint16_t ss;
+    // segment of the first DOS memory control block
+    uint16_t first_mcb;
+    // DOS List of Lists and swappable data area, offset then segment
+    uint16_t lol_off;
+    uint16_t lol_seg;
+    uint16_t sda_off;
+    uint16_t sda_seg;
+    // INT 21h AH=30h, major version in the high byte
+    uint16_t dos_version;
 } __attribute__((packed))
 vm86_init_t;
 
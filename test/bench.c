@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "harness.h"
+#include "insn.h"
+#include "kbd.h"
+#include "mem.h"
+
+#define ITERATIONS 1000000
+
+static task_t task;
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+report(const char* name, uint64_t start, uint64_t end)
+{
+    double ns = (double)(end - start) / ITERATIONS;
+    printf("%-28s %8.1f ns/op %12.0f ops/s\n", name, ns, 1e9 / ns);
+}
+
+static void
+bench_insn_cached()
+{
+    harness_reset(&task);
+    CODE(&task, 0xee); // out dx, al
+    task.regs->edx.word.lo = 0x300;
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        task.regs->eip.word.lo = 0;
+        bus_log_len = 0;
+        emulate_insn(&task);
+    }
+
+    report("emulate_insn cached", start, now_ns());
+}
+
+static void
+bench_insn_miss()
+{
+    harness_reset(&task);
+    task.regs->edx.word.lo = 0x300;
+
+    // rewriting the opcode every time forces the decode path
+    uint8_t* code = linear(TEST_CS, 0);
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        *code = (i & 1) ? 0xef : 0xee;
+        task.regs->eip.word.lo = 0;
+        bus_log_len = 0;
+        emulate_insn(&task);
+    }
+
+    report("emulate_insn miss", start, now_ns());
+}
+
+static void
+bench_kbd_peek()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+    kbd_send_input(&task.kbd, 0x1e);
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        task.regs->eax.word.lo = 0x0100;
+        kbd_int(&task.kbd, task.regs);
+    }
+
+    report("kbd_int ah=01", start, now_ns());
+}
+
+static void
+bench_process_key()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        // shift press and release changes flags without filling the buffer
+        kbd_send_input(&task.kbd, 0x2a);
+        kbd_send_input(&task.kbd, 0xaa);
+    }
+
+    report("process_key x2", start, now_ns());
+}
+
+static void
+bench_dequeue_key()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+    uint16_t keycode = 0x1e61;
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        kbd_inject(&task.kbd, &keycode, 1);
+        task.regs->eax.word.lo = 0x0000;
+        kbd_int(&task.kbd, task.regs);
+    }
+
+    report("kbd_inject + kbd_int ah=00", start, now_ns());
+}
+
+int
+main()
+{
+    bench_insn_cached();
+    bench_insn_miss();
+    bench_kbd_peek();
+    bench_process_key();
+    bench_dequeue_key();
+    return 0;
+}
@@ -0,0 +1,471 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "insn.h"
+#include "kbd.h"
+#include "mem.h"
+#include "port.h"
+#include "redir.h"
+#include "stats.h"
+
+static task_t task;
+
+// the bus log entry for the nth write
+#define WROTE(n, p, w, v) do { \
+        CHECK((n) < bus_log_len); \
+        CHECK_EQ(bus_log[n].port, p); \
+        CHECK_EQ(bus_log[n].width, w); \
+        CHECK_EQ(bus_log[n].value, v); \
+    } while (0)
+
+static void
+test_out_dx()
+{
+    harness_reset(&task);
+    CODE(&task, 0xee); // out dx, al
+    task.regs->edx.word.lo = 0x300;
+    task.regs->eax.byte.lo = 0x5a;
+
+    emulate_insn(&task);
+
+    CHECK_EQ(bus_log_len, 1);
+    WROTE(0, 0x300, 1, 0x5a);
+    CHECK_EQ(task.regs->eip.word.lo, 1);
+}
+
+static void
+test_in_imm_opsize()
+{
+    harness_reset(&task);
+    CODE(&task, 0x66, 0xe5, 0x80); // in eax, 0x80
+    bus_values[0x80] = 0x12345678;
+
+    emulate_insn(&task);
+
+    CHECK_EQ(task.regs->eax.dword, 0x12345678);
+    CHECK_EQ(task.regs->eip.word.lo, 3);
+}
+
+static void
+test_rep_outsb()
+{
+    harness_reset(&task);
+    CODE(&task, 0xf3, 0x6e); // rep outsb
+    memcpy(linear(TEST_CS, 0x200), "DOS!", 4);
+    task.regs->edx.word.lo = 0x300;
+    task.regs->esi.word.lo = 0x200;
+    task.regs->ecx.word.lo = 4;
+
+    emulate_insn(&task);
+
+    CHECK_EQ(bus_log_len, 4);
+    WROTE(0, 0x300, 1, 'D');
+    WROTE(3, 0x300, 1, '!');
+    CHECK_EQ(task.regs->esi.word.lo, 0x204);
+    CHECK_EQ(task.regs->ecx.word.lo, 0);
+    CHECK_EQ(task.regs->eip.word.lo, 2);
+}
+
+static void
+test_rep_insw_backwards()
+{
+    harness_reset(&task);
+    CODE(&task, 0xf3, 0x6d); // rep insw
+    bus_values[0x1f0] = 0xbeef;
+    task.regs->edx.word.lo = 0x1f0;
+    task.regs->edi.word.lo = 0x204;
+    task.regs->ecx.word.lo = 3;
+    task.regs->eflags.dword |= FLAG_DIRECTION;
+
+    emulate_insn(&task);
+
+    uint16_t* words = linear(TEST_CS, 0x1fe);
+    CHECK_EQ(words[0], 0);
+    CHECK_EQ(words[1], 0xbeef);
+    CHECK_EQ(words[3], 0xbeef);
+    CHECK_EQ(words[4], 0);
+    CHECK_EQ(task.regs->edi.word.lo, 0x1fe);
+    CHECK_EQ(task.regs->ecx.word.lo, 0);
+}
+
+static void
+test_segment_override()
+{
+    harness_reset(&task);
+    CODE(&task, 0x2e, 0x6e); // cs outsb
+    task.regs->ds16.word.lo = 0x2000;
+    task.regs->edx.word.lo = 0x300;
+    task.regs->esi.word.lo = 0; // cs:0 is the prefix byte itself
+
+    emulate_insn(&task);
+
+    WROTE(0, 0x300, 1, 0x2e);
+    CHECK_EQ(task.regs->eip.word.lo, 2);
+}
+
+static void
+test_emulated_port()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+    CODE(&task, 0xe4, 0x64); // in al, 0x64
+
+    emulate_insn(&task);
+
+    // status without data, and the emulation did not touch the bus
+    CHECK_EQ(task.regs->eax.byte.lo, 0x04);
+    CHECK_EQ(bus_log_len, 0);
+
+    kbd_send_input(&task.kbd, 0x1e);
+    task.regs->eip.word.lo = 0;
+    emulate_insn(&task);
+    CHECK_EQ(task.regs->eax.byte.lo, 0x05);
+
+    CODE(&task, 0xe4, 0x60); // in al, 0x60
+    emulate_insn(&task);
+    CHECK_EQ(task.regs->eax.byte.lo, 0x1e);
+    CHECK(!kbd_has_output(&task.kbd));
+}
+
+static void
+test_kbd_discard_output()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+
+    kbd_send_input(&task.kbd, 0x1e);
+    kbd_send_input(&task.kbd, 0x9e);
+    kbd_discard_output(&task.kbd);
+    CHECK(!kbd_has_output(&task.kbd));
+
+    // a poll of the data port still sees the newest scancode
+    CODE(&task, 0xe4, 0x60); // in al, 0x60
+    emulate_insn(&task);
+    CHECK_EQ(task.regs->eax.byte.lo, 0x9e);
+
+    // and the next one is delivered on its own
+    kbd_send_input(&task.kbd, 0x30);
+    task.regs->eip.word.lo = 0;
+    emulate_insn(&task);
+    CHECK_EQ(task.regs->eax.byte.lo, 0x30);
+    CHECK(!kbd_has_output(&task.kbd));
+}
+
+static void
+test_insn_cache()
+{
+    harness_reset(&task);
+    CODE(&task, 0xee); // out dx, al
+    task.regs->edx.word.lo = 0x300;
+
+    emulate_insn(&task);
+    task.regs->eip.word.lo = 0;
+    emulate_insn(&task);
+
+    CHECK_EQ(stats->insn_cache_misses, 1);
+    CHECK_EQ(stats->insn_cache_hits, 1);
+
+    // self modifying code must not hit the stale entry
+    CODE(&task, 0xef); // out dx, ax
+    task.regs->eax.word.lo = 0x1234;
+    emulate_insn(&task);
+
+    CHECK_EQ(stats->insn_cache_misses, 2);
+    WROTE(2, 0x300, 2, 0x1234);
+}
+
+static void
+test_hlt()
+{
+    harness_reset(&task);
+    CODE(&task, 0xf4);
+
+    emulate_insn(&task);
+
+    CHECK(task.halted);
+    CHECK_EQ(task.regs->eip.word.lo, 1);
+}
+
+static uint16_t
+int16(uint8_t ah, bool* returned)
+{
+    task.regs->eax.word.lo = ah << 8;
+    *returned = kbd_int(&task.kbd, task.regs);
+    return task.regs->eax.word.lo;
+}
+
+static void
+test_kbd_keys()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+    bool returned;
+
+    // 'a' press and release, then shift + 'a'
+    const uint8_t scancodes[] = { 0x1e, 0x9e, 0x2a, 0x1e, 0x9e, 0xaa };
+    kbd_send_input_bulk(&task.kbd, scancodes, sizeof(scancodes));
+
+    CHECK_EQ(int16(0x01, &returned), 0x1e61);
+    CHECK(!(task.regs->eflags.word.lo & FLAG_ZERO));
+    CHECK_EQ(int16(0x00, &returned), 0x1e61);
+    CHECK(returned);
+    CHECK_EQ(int16(0x00, &returned), 0x1e41);
+
+    int16(0x01, &returned);
+    CHECK(task.regs->eflags.word.lo & FLAG_ZERO);
+
+    // nothing buffered, a blocking read has to wait
+    int16(0x00, &returned);
+    CHECK(!returned);
+}
+
+static void
+test_kbd_ring()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+    bool returned;
+    uint32_t size = kbd_free_space(&task.kbd);
+
+    CHECK_EQ(size, KBD_BUFFER_SIZE);
+
+    // go round the ring a few times, keeping it partly full. ascii
+    // stays below 0x80 so int 16h does not translate e0/f0 codes
+    uint16_t next_in = 0, next_out = 0;
+
+    for (int round = 0; round < 5; round++) {
+        while (kbd_free_space(&task.kbd) > 3) {
+            uint16_t keycode = 0x1e00 | (next_in++ & 0x7f);
+            CHECK_EQ(kbd_inject(&task.kbd, &keycode, 1), 1);
+        }
+
+        while (kbd_free_space(&task.kbd) < size - 2) {
+            CHECK_EQ(int16(0x00, &returned), 0x1e00 | (next_out++ & 0x7f));
+        }
+    }
+
+    // overflowing from the keyboard drops and counts
+    while (kbd_free_space(&task.kbd)) {
+        uint16_t keycode = 0x3920;
+        kbd_inject(&task.kbd, &keycode, 1);
+    }
+
+    kbd_send_input(&task.kbd, 0x39);
+    CHECK_EQ(stats->kbd_dropped_keys, 1);
+}
+
+#define FCB_IS(name, wild, expected) do { \
+        char fcb_[11]; \
+        CHECK(redir_fcb_name(name, fcb_, wild)); \
+        CHECK(memcmp(fcb_, expected, 11) == 0); \
+    } while (0)
+
+static void
+test_redir_fcb_name()
+{
+    char fcb[11];
+
+    FCB_IS("readme.txt", false, "README  TXT");
+    FCB_IS("Makefile", false, "MAKEFILE   ");
+    FCB_IS("..", false, "..         ");
+
+    // wildcards, * fills the rest of the part with ?
+    FCB_IS("*.*", true, "???????????");
+    FCB_IS("FOO*.T?T", true, "FOO?????T?T");
+    FCB_IS("*", true, "????????   ");
+    CHECK(!redir_fcb_name("*.*", fcb, false));
+    CHECK(!redir_fcb_name("a?c", fcb, false));
+
+    // anything that doesn't fit 8.3
+    CHECK(!redir_fcb_name("longfilename.txt", fcb, false));
+    CHECK(!redir_fcb_name("x.abcd", fcb, false));
+    CHECK(!redir_fcb_name("a.b.c", fcb, false));
+    CHECK(!redir_fcb_name(".profile", fcb, false));
+    CHECK(!redir_fcb_name("x.", fcb, false));
+    CHECK(!redir_fcb_name("a+b", fcb, false));
+    CHECK(!redir_fcb_name("", fcb, false));
+
+    CHECK(redir_fcb_match("????????TXT", "README  TXT"));
+    CHECK(redir_fcb_match("README  TXT", "README  TXT"));
+    CHECK(!redir_fcb_match("????????TXT", "README  DOC"));
+    CHECK(!redir_fcb_match("R???????   ", "README  TXT"));
+}
+
+// a fake List of Lists and CDS array for redir_init, DOS 6.22 with
+// LASTDRIVE=Z
+#define REDIR_LOL_SEG 0x50
+#define REDIR_CDS_SEG 0x60
+#define REDIR_SDA_SEG 0x100
+
+static void
+test_redir_map_path()
+{
+    harness_reset(&task);
+
+    char dir[] = "/tmp/dslcheckXXXXXX";
+    char real[PATH_MAX], expected[PATH_MAX + 16], path[PATH_MAX];
+    bool exists;
+
+    CHECK(mkdtemp(dir) != NULL);
+    CHECK(realpath(dir, real) != NULL);
+
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    CHECK(mkdir(path, 0755) == 0);
+    snprintf(path, sizeof(path), "%s/ReadMe.txt", dir);
+    close(open(path, O_CREAT | O_WRONLY, 0644));
+
+    poke16(REDIR_LOL_SEG, 0x16, 0);
+    poke16(REDIR_LOL_SEG, 0x18, REDIR_CDS_SEG);
+    *(uint8_t*)linear(REDIR_LOL_SEG, 0x21) = 26;
+
+    vm86_init_t init = {
+        .lol_seg = REDIR_LOL_SEG,
+        .sda_seg = REDIR_SDA_SEG,
+        .dos_version = 0x0314,
+    };
+
+    char param[PATH_MAX + 2];
+    snprintf(param, sizeof(param), "L:%s", dir);
+
+    // off by default, and refused before DOS 4
+    unsetenv("dsl_drive");
+    CHECK(!redir_init(&init));
+    setenv("dsl_drive", param, 1);
+    CHECK(!redir_init(&init));
+
+    init.dos_version = 0x0616;
+    CHECK(redir_init(&init));
+    CHECK_EQ(peek16(REDIR_CDS_SEG, 11 * 0x58 + 0x43), 0xc000);
+
+    // names match case insensitively
+    CHECK_EQ(redir_map_path("L:\\README.TXT", 13, path, &exists), 0);
+    snprintf(expected, sizeof(expected), "%s/ReadMe.txt", real);
+    CHECK(exists);
+    CHECK(strcmp(path, expected) == 0);
+
+    // the root, and a trailing backslash
+    CHECK_EQ(redir_map_path("L:\\", 3, path, &exists), 0);
+    CHECK(exists);
+    CHECK(strcmp(path, real) == 0);
+
+    CHECK_EQ(redir_map_path("L:\\SUB\\", 7, path, &exists), 0);
+    snprintf(expected, sizeof(expected), "%s/sub", real);
+    CHECK(exists);
+    CHECK(strcmp(path, expected) == 0);
+
+    // a missing last component is lower cased to be created
+    CHECK_EQ(redir_map_path("L:\\SUB\\NEW.TXT", 14, path, &exists), 0);
+    snprintf(expected, sizeof(expected), "%s/sub/new.txt", real);
+    CHECK(!exists);
+    CHECK(strcmp(path, expected) == 0);
+
+    // only the directory part of a path
+    CHECK_EQ(redir_map_path("L:\\SUB\\*.*", 6, path, &exists), 0);
+    snprintf(expected, sizeof(expected), "%s/sub", real);
+    CHECK(strcmp(path, expected) == 0);
+
+    // anything missing before the last component is path not found
+    CHECK_EQ(redir_map_path("L:\\NOPE\\X.TXT", 13, path, &exists), 0x03);
+
+    snprintf(path, sizeof(path), "%s/ReadMe.txt", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/sub", dir);
+    rmdir(path);
+    rmdir(dir);
+    unsetenv("dsl_drive");
+}
+
+static int space_calls;
+
+static void
+on_space(void* ctx)
+{
+    (void)ctx;
+    space_calls++;
+}
+
+static void
+test_kbd_notify_space()
+{
+    harness_reset(&task);
+    kbd_init(&task.kbd);
+    bool returned;
+
+    uint16_t keycodes[KBD_BUFFER_SIZE];
+
+    for (int i = 0; i < KBD_BUFFER_SIZE; i++) {
+        keycodes[i] = 0x1e61;
+    }
+
+    CHECK_EQ(kbd_inject(&task.kbd, keycodes, KBD_BUFFER_SIZE + 1), KBD_BUFFER_SIZE);
+
+    space_calls = 0;
+    kbd_notify_space(&task.kbd, on_space, NULL);
+
+    for (int i = 0; i < KBD_BUFFER_SIZE; i++) {
+        int16(0x00, &returned);
+    }
+
+    CHECK_EQ(space_calls, 1);
+}
+
+static void
+test_ascii_keycode()
+{
+    CHECK_EQ(kbd_ascii_keycode('a'), 0x1e61);
+    CHECK_EQ(kbd_ascii_keycode('A'), 0x1e41);
+    CHECK_EQ(kbd_ascii_keycode('1'), 0x0231);
+    CHECK_EQ(kbd_ascii_keycode('!'), 0x0221);
+    CHECK_EQ(kbd_ascii_keycode('\r'), 0x1c0d);
+    CHECK_EQ(kbd_ascii_keycode(' '), 0x3920);
+    CHECK_EQ(kbd_ascii_keycode(0), 0);
+    CHECK_EQ(kbd_ascii_keycode(0x80), 0);
+}
+
+static const struct {
+    const char* name;
+    void (*fn)();
+} tests[] = {
+    { "out dx", test_out_dx },
+    { "in imm with operand size prefix", test_in_imm_opsize },
+    { "rep outsb", test_rep_outsb },
+    { "rep insw backwards", test_rep_insw_backwards },
+    { "segment override", test_segment_override },
+    { "emulated port", test_emulated_port },
+    { "kbd discard output", test_kbd_discard_output },
+    { "insn cache", test_insn_cache },
+    { "hlt", test_hlt },
+    { "kbd keys", test_kbd_keys },
+    { "kbd ring", test_kbd_ring },
+    { "redir fcb name", test_redir_fcb_name },
+    { "redir map path", test_redir_map_path },
+    { "kbd notify space", test_kbd_notify_space },
+    { "ascii keycode", test_ascii_keycode },
+};
+
+int
+main()
+{
+    int failed_tests = 0;
+    size_t count = sizeof(tests) / sizeof(tests[0]);
+
+    for (size_t i = 0; i < count; i++) {
+        int before = checks_failed;
+        tests[i].fn();
+
+        if (checks_failed != before) {
+            fprintf(stderr, "FAIL %s\n", tests[i].name);
+            failed_tests++;
+        }
+    }
+
+    printf("%zu tests, %d failed\n", count, failed_tests);
+    return failed_tests ? 1 : 0;
+}
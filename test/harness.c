@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "mem.h"
+#include "port.h"
+#include "stats.h"
+#include "trace.h"
+
+uint8_t* guest_mem;
+
+uint32_t bus_values[0x10000];
+bus_write_t bus_log[BUS_LOG_SIZE];
+size_t bus_log_len;
+
+int checks_failed;
+
+static regs_t regs;
+
+uint32_t
+host_port_in(uint16_t port, uint16_t width)
+{
+    (void)width;
+    return bus_values[port];
+}
+
+void
+host_port_out(uint16_t port, uint16_t width, uint32_t value)
+{
+    if (bus_log_len < BUS_LOG_SIZE) {
+        bus_log[bus_log_len++] = (bus_write_t) { .port = port, .width = width, .value = value };
+    }
+
+    bus_values[port] = value;
+}
+
+void
+harness_reset(task_t* task)
+{
+    if (!guest_mem) {
+        guest_mem = malloc(GUEST_MEM_SIZE);
+        stats = malloc(sizeof(stats_t));
+        trace_ring = malloc(sizeof(trace_ring_t));
+    }
+
+    memset(guest_mem, 0, GUEST_MEM_SIZE);
+    memset(stats, 0, sizeof(stats_t));
+    memset(trace_ring, 0, sizeof(trace_ring_t));
+    trace_ring->level = TRACE_OFF;
+
+    memset(bus_values, 0, sizeof(bus_values));
+    bus_log_len = 0;
+
+    port_init();
+
+    memset(&regs, 0, sizeof(regs));
+    regs.cs.word.lo = TEST_CS;
+    regs.ds16.word.lo = TEST_CS;
+    regs.es16.word.lo = TEST_CS;
+    regs.ss.word.lo = TEST_CS;
+    regs.esp.word.lo = 0xfffe;
+    regs.eflags.dword = FLAG_VM8086 | FLAG_VIF;
+
+    memset(task, 0, sizeof(*task));
+    task->regs = &regs;
+}
+
+void
+harness_code(task_t* task, uint16_t ip, const uint8_t* code, size_t len)
+{
+    memcpy(linear(TEST_CS, ip), code, len);
+    task->regs->cs.word.lo = TEST_CS;
+    task->regs->eip.word.lo = ip;
+}
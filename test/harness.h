@@ -0,0 +1,67 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "task.h"
+
+// host build of the VMM units that do not need a vm86 kernel: the decoder,
+// port dispatch and keyboard. guest memory is a malloc'd arena standing in for
+// the identity mapped first megabyte, and port I/O to anything not emulated
+// goes to a mock bus instead of hardware
+
+// size of the arena, the first megabyte plus the HMA like run_vmm maps
+#define GUEST_MEM_SIZE 0x110000
+
+// segment test code is placed at
+#define TEST_CS 0x1000
+
+// mock bus: what reads of each port return, and a log of writes
+#define BUS_LOG_SIZE 256
+
+typedef struct bus_write {
+    uint16_t port;
+    uint16_t width;
+    uint32_t value;
+}
+bus_write_t;
+
+extern uint32_t bus_values[0x10000];
+extern bus_write_t bus_log[BUS_LOG_SIZE];
+extern size_t bus_log_len;
+
+// resets guest memory, the port bus, stats and the port table, and sets up
+// task with registers pointing at TEST_CS:0
+void
+harness_reset(task_t* task);
+
+// copies code to TEST_CS:ip and points CS:IP at it
+void
+harness_code(task_t* task, uint16_t ip, const uint8_t* code, size_t len);
+
+#define CODE(task, ...) do { \
+        const uint8_t code_[] = { __VA_ARGS__ }; \
+        harness_code(task, 0, code_, sizeof(code_)); \
+    } while (0)
+
+extern int checks_failed;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            checks_failed++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+        unsigned long long a_ = (actual), e_ = (expected); \
+        if (a_ != e_) { \
+            fprintf(stderr, "%s:%d: %s is 0x%llx, expected 0x%llx\n", \
+                __FILE__, __LINE__, #actual, a_, e_); \
+            checks_failed++; \
+        } \
+    } while (0)
+
+#endif